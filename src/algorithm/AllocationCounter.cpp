@@ -0,0 +1,59 @@
+#include "AllocationCounter.h"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+static thread_local uint64_t allocationCount = 0;
+
+uint64_t threadAllocationCount()
+{
+	return allocationCount;
+}
+
+// The nothrow forms are implemented in terms of these by the standard library. Aligned ones use their own
+// allocation and are not counted
+void *operator new(std::size_t size)
+{
+	allocationCount++;
+	void *memory = std::malloc(size > 0 ? size : 1);
+	if (!memory) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+#else
+
+uint64_t threadAllocationCount()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+// Number of heap allocations made by the calling thread so far. Builds with COUNT_ALLOCATIONS defined (the CMake
+// option of the same name) replace the global operator new to count them, which is how the allocation-free steady
+// state of the analysis is checked. Other builds leave operator new alone and always return 0
+uint64_t threadAllocationCount();
+
+#endif
@@ -0,0 +1,177 @@
+#include "ChannelSums.h"
+
+#include <obs-module.h>
+#include "plugin-support.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CHANNEL_SUMS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC compiles intrinsics of any instruction set without a target attribute
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CHANNEL_SUMS_NEON
+#include <arm_neon.h>
+#endif
+
+void sumBGRASpanScalar(const uint8_t *pixels, uint32_t count, ChannelSums &sums)
+{
+	uint64_t b = 0, g = 0, r = 0;
+	for (uint32_t i = 0; i < count; ++i, pixels += 4) {
+		b += pixels[0];
+		g += pixels[1];
+		r += pixels[2];
+	}
+	sums.b += b;
+	sums.g += g;
+	sums.r += r;
+}
+
+uint32_t sumBGRASpanStrided(const uint8_t *pixels, uint32_t count, uint32_t step, ChannelSums &sums)
+{
+	uint64_t b = 0, g = 0, r = 0;
+	uint32_t sampled = 0;
+	for (uint32_t i = 0; i < count; i += step, pixels += static_cast<size_t>(step) * 4) {
+		b += pixels[0];
+		g += pixels[1];
+		r += pixels[2];
+		sampled++;
+	}
+	sums.b += b;
+	sums.g += g;
+	sums.r += r;
+	return sampled;
+}
+
+#ifdef CHANNEL_SUMS_X86
+// Every kernel isolates one channel in the low byte of each 32-bit pixel and sums bytes with psadbw, which adds
+// the 8 bytes of each 64-bit lane into that lane. The lanes hold at most 8 * 255 per step, so 64-bit
+// accumulators cannot overflow
+
+static void sumBGRASpanSSE2(const uint8_t *pixels, uint32_t count, ChannelSums &sums)
+{
+	const __m128i low_byte = _mm_set1_epi32(0xFF);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i b = zero, g = zero, r = zero;
+
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4, pixels += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+		b = _mm_add_epi64(b, _mm_sad_epu8(_mm_and_si128(v, low_byte), zero));
+		g = _mm_add_epi64(g, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(v, 8), low_byte), zero));
+		r = _mm_add_epi64(r, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(v, 16), low_byte), zero));
+	}
+
+	alignas(16) uint64_t lanes[2];
+	_mm_store_si128(reinterpret_cast<__m128i *>(lanes), b);
+	sums.b += lanes[0] + lanes[1];
+	_mm_store_si128(reinterpret_cast<__m128i *>(lanes), g);
+	sums.g += lanes[0] + lanes[1];
+	_mm_store_si128(reinterpret_cast<__m128i *>(lanes), r);
+	sums.r += lanes[0] + lanes[1];
+
+	sumBGRASpanScalar(pixels, count - i, sums);
+}
+
+TARGET_AVX2 static void sumBGRASpanAVX2(const uint8_t *pixels, uint32_t count, ChannelSums &sums)
+{
+	const __m256i low_byte = _mm256_set1_epi32(0xFF);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i b = zero, g = zero, r = zero;
+
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8, pixels += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels));
+		b = _mm256_add_epi64(b, _mm256_sad_epu8(_mm256_and_si256(v, low_byte), zero));
+		g = _mm256_add_epi64(g, _mm256_sad_epu8(_mm256_and_si256(_mm256_srli_epi32(v, 8), low_byte), zero));
+		r = _mm256_add_epi64(r, _mm256_sad_epu8(_mm256_and_si256(_mm256_srli_epi32(v, 16), low_byte), zero));
+	}
+
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), b);
+	sums.b += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), g);
+	sums.g += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), r);
+	sums.r += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	sumBGRASpanSSE2(pixels, count - i, sums);
+}
+
+static bool cpuSupportsAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	// OSXSAVE and AVX, and the OS saves the YMM registers
+	bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	return avx && (info[1] & (1 << 5));
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#ifdef CHANNEL_SUMS_NEON
+static void sumBGRASpanNEON(const uint8_t *pixels, uint32_t count, ChannelSums &sums)
+{
+	// vld4q de-interleaves 16 pixels into one register per channel, and the widening adds keep 32-bit lanes that
+	// are flushed to the 64-bit sums every 4096 pixels, well before they could overflow
+	uint32_t i = 0;
+	while (i + 16 <= count) {
+		uint32x4_t b = vdupq_n_u32(0), g = vdupq_n_u32(0), r = vdupq_n_u32(0);
+		uint32_t block_end = count - i > 4096 ? i + 4096 : count;
+		for (; i + 16 <= block_end; i += 16, pixels += 64) {
+			uint8x16x4_t v = vld4q_u8(pixels);
+			b = vpadalq_u16(b, vpaddlq_u8(v.val[0]));
+			g = vpadalq_u16(g, vpaddlq_u8(v.val[1]));
+			r = vpadalq_u16(r, vpaddlq_u8(v.val[2]));
+		}
+		sums.b += vaddlvq_u32(b);
+		sums.g += vaddlvq_u32(g);
+		sums.r += vaddlvq_u32(r);
+	}
+
+	sumBGRASpanScalar(pixels, count - i, sums);
+}
+#endif
+
+static BGRASpanSumKernel bgra_span_sum = sumBGRASpanScalar;
+
+BGRASpanSumKernel getBGRASpanSumKernel()
+{
+	return bgra_span_sum;
+}
+
+size_t supportedBGRASpanSumKernels(BGRASpanSumKernelInfo *kernels)
+{
+	size_t count = 0;
+	kernels[count++] = {"scalar", sumBGRASpanScalar};
+#if defined(CHANNEL_SUMS_X86)
+	kernels[count++] = {"SSE2", sumBGRASpanSSE2};
+	if (cpuSupportsAVX2()) {
+		kernels[count++] = {"AVX2", sumBGRASpanAVX2};
+	}
+#elif defined(CHANNEL_SUMS_NEON)
+	kernels[count++] = {"NEON", sumBGRASpanNEON};
+#endif
+	return count;
+}
+
+void initChannelSumKernels()
+{
+	BGRASpanSumKernelInfo kernels[BGRA_SPAN_SUM_KERNEL_MAX];
+	size_t count = supportedBGRASpanSumKernels(kernels);
+	bgra_span_sum = kernels[count - 1].kernel;
+	obs_log(LOG_INFO, "Using the %s channel sum kernel", kernels[count - 1].name);
+}
@@ -0,0 +1,42 @@
+#ifndef CHANNEL_SUMS_H
+#define CHANNEL_SUMS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Per-channel sums of a run of pixels
+struct ChannelSums {
+	uint64_t b = 0;
+	uint64_t g = 0;
+	uint64_t r = 0;
+};
+
+// Add the B, G and R of count consecutive BGRA pixels to sums. Every kernel accumulates in integers and gives the
+// exact same result as the scalar one
+typedef void (*BGRASpanSumKernel)(const uint8_t *pixels, uint32_t count, ChannelSums &sums);
+
+void sumBGRASpanScalar(const uint8_t *pixels, uint32_t count, ChannelSums &sums);
+
+// Add the B, G and R of every step-th of count consecutive BGRA pixels, starting with the first, to sums and return
+// the number of pixels sampled
+uint32_t sumBGRASpanStrided(const uint8_t *pixels, uint32_t count, uint32_t step, ChannelSums &sums);
+
+// Most kernels one build can have: scalar, SSE2 and AVX2 on x86
+#define BGRA_SPAN_SUM_KERNEL_MAX 3
+
+struct BGRASpanSumKernelInfo {
+	const char *name;
+	BGRASpanSumKernel kernel;
+};
+
+// Write the kernels built in that the CPU supports to kernels, scalar first and fastest last, and return their
+// number. The test and benchmark executables check and time every one of them
+size_t supportedBGRASpanSumKernels(BGRASpanSumKernelInfo *kernels);
+
+// Pick the fastest kernel the CPU supports, called once when the module loads, before any frame is analysed
+void initChannelSumKernels();
+
+// Kernel picked by initChannelSumKernels(), the scalar one until then
+BGRASpanSumKernel getBGRASpanSumKernel();
+
+#endif
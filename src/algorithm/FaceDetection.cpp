@@ -2,10 +2,25 @@
 
 #include <graphics/matrix4.h>
 #include <algorithm>
+#include <mutex>
 
-// Static variables for face detection
+// Side in pixels the face is resampled to for the eye and mouth cascades, so that they search the same few scales
+// whatever the size of the face in the frame
+#define CANONICAL_FACE_SIZE 128
+
+// The LBP cascade has a 45 pixel window against the 24 of the Haar one and rejects more windows per stage, so a face
+// collects far fewer overlapping hits: the 10 the Haar cascade needs would drop most faces it finds. It is run with
+// the OpenCV default of 3 instead, and never searches below its own window
+static const FaceCascadeSettings haarFaceCascade = {"haarcascade_frontalface_default.xml", 1.1, 10, 24};
+static const FaceCascadeSettings lbpFaceCascade = {"lbpcascade_frontalface_improved.xml", 1.1, 3, 45};
+
+// Static variables for face detection. The LBP face cascade is only loaded once the LBP detector is picked
 static cv::CascadeClassifier face_cascade, mouth_cascade, left_eye_cascade, right_eye_cascade;
+static cv::CascadeClassifier lbp_face_cascade;
 static bool cascade_loaded = false;
+static bool lbp_cascade_loaded = false;
+// The cascades are shared by the analysis workers of every filter
+static std::mutex cascade_mutex;
 
 static void loadCascade(cv::CascadeClassifier &cascade, const char *module_name, const char *file_name)
 {
@@ -23,11 +38,19 @@ static void loadCascade(cv::CascadeClassifier &cascade, const char *module_name,
 	bfree(cascade_path);
 }
 
-// Ensure the face cascade is loaded once
-static void initializeFaceCascade()
+// Ensure the cascades of the detector are loaded once
+static void initializeFaceCascade(enum face_detector detector)
 {
+	if (detector == FACE_DETECTOR_LBP) {
+		if (!lbp_cascade_loaded) {
+			loadCascade(lbp_face_cascade, "pulse-obs", lbpFaceCascade.file);
+			lbp_cascade_loaded = true;
+		}
+		return;
+	}
+
 	if (!cascade_loaded) {
-		loadCascade(face_cascade, "pulse-obs", "haarcascade_frontalface_default.xml");
+		loadCascade(face_cascade, "pulse-obs", haarFaceCascade.file);
 		loadCascade(mouth_cascade, "pulse-obs", "haarcascade_mcs_mouth.xml");
 		loadCascade(left_eye_cascade, "pulse-obs", "haarcascade_lefteye_2splits.xml");
 		loadCascade(right_eye_cascade, "pulse-obs", "haarcascade_righteye_2splits.xml");
@@ -35,14 +58,14 @@ static void initializeFaceCascade()
 	}
 }
 
-// Mark pixels within detected regions as true/false depending on whether its the face/eyes/mouth
-static void mask_face(std::vector<std::vector<bool>> &face_mask, cv::Rect rect, bool is_face)
+static MaskRect toMaskRect(const cv::Rect &rect)
 {
-	for (int y = rect.y; y < rect.y + rect.height; ++y) {
-		for (int x = rect.x; x < rect.x + rect.width; ++x) {
-			face_mask[y][x] = is_face;
-		}
-	}
+	MaskRect mask_rect;
+	mask_rect.x = rect.x;
+	mask_rect.y = rect.y;
+	mask_rect.width = rect.width;
+	mask_rect.height = rect.height;
+	return mask_rect;
 }
 
 // Normalise the rectangle coordinates to pass to the effect files for drawing boxes
@@ -58,110 +81,179 @@ static struct vec4 getNormalisedRect(const cv::Rect &region, uint32_t width, uin
 	return rect;
 }
 
-// Function to detect faces and create a mask
-std::vector<std::vector<bool>> detectFacesAndCreateMask(struct input_BGRA_data *frame,
-							std::vector<struct vec4> &face_coordinates)
+// Rectangle of the grayscale image scaled back to the width x height frame
+static cv::Rect toFrame(const cv::Rect &rect, int factor, uint32_t width, uint32_t height)
+{
+	cv::Rect scaled(rect.x * factor, rect.y * factor, rect.width * factor, rect.height * factor);
+	return scaled & cv::Rect(0, 0, static_cast<int>(width), static_cast<int>(height));
+}
+
+// Window of the image that a re-detection searches: the previous face, given in pixels of the frame, padded by half
+// its size on every side. side is set to the larger dimension of the previous face in the image
+static cv::Rect searchWindow(const MaskRect &previous_face, int factor, const cv::Size &image, int &side)
+{
+	cv::Rect previous(previous_face.x / factor, previous_face.y / factor, previous_face.width / factor,
+			  previous_face.height / factor);
+	cv::Rect window(previous.x - previous.width / 2, previous.y - previous.height / 2, previous.width * 2,
+			previous.height * 2);
+	side = std::max(previous.width, previous.height);
+	return window & cv::Rect(0, 0, image.width, image.height);
+}
+
+// Eye and mouth rectangles at the proportions of a frontal face, for detectors that find only the face
+static void addGeometricExclusions(const cv::Rect &face, std::vector<cv::Rect> &exclusions)
+{
+	int eye_width = face.width * 3 / 10;
+	int eye_height = face.height / 5;
+	int eye_top = face.y + face.height * 2 / 10;
+	exclusions.push_back(cv::Rect(face.x + face.width * 15 / 100, eye_top, eye_width, eye_height));
+	exclusions.push_back(cv::Rect(face.x + face.width * 55 / 100, eye_top, eye_width, eye_height));
+	exclusions.push_back(cv::Rect(face.x + face.width / 4, face.y + face.height * 68 / 100, face.width / 2,
+				      eye_height));
+}
+
+// Append a face found in the image and the eye and mouth rectangles excluded from it to the outputs. The first face
+// becomes the skin mask
+static void addFace(const cv::Rect &face, const std::vector<cv::Rect> &exclusions, bool first, int factor,
+		    uint32_t width, uint32_t height, SkinMask &face_mask, std::vector<struct vec4> &face_coordinates,
+		    std::vector<struct vec4> &skin_regions)
 {
-	if (!frame || !frame->data) {
-		throw std::runtime_error("Invalid BGRA frame data!");
+	cv::Rect frame_face = toFrame(face, factor, width, height);
+	face_coordinates.push_back(getNormalisedRect(frame_face, width, height));
+	for (const cv::Rect &exclusion : exclusions) {
+		face_coordinates.push_back(getNormalisedRect(toFrame(exclusion, factor, width, height), width, height));
 	}
 
-	// Initialize the face cascade
-	initializeFaceCascade();
+	if (first) {
+		// The face is the skin region, minus the eye and mouth regions
+		face_mask.setInclusion(toMaskRect(frame_face));
+		skin_regions.push_back(getNormalisedRect(frame_face, width, height));
+		for (const cv::Rect &exclusion : exclusions) {
+			cv::Rect frame_exclusion = toFrame(exclusion, factor, width, height);
+			face_mask.addExclusion(toMaskRect(frame_exclusion));
+			skin_regions.push_back(getNormalisedRect(frame_exclusion, width, height));
+		}
+	}
+}
 
-	// Extract frame parameters
-	uint8_t *data = frame->data;
-	uint32_t width = frame->width;
-	uint32_t height = frame->height;
-	uint32_t linesize = frame->linesize;
+const FaceCascadeSettings &faceCascadeSettings(enum face_detector detector)
+{
+	return detector == FACE_DETECTOR_LBP ? lbpFaceCascade : haarFaceCascade;
+}
 
-	// Initialize a 2D boolean mask
-	std::vector<std::vector<bool>> face_mask(height, std::vector<bool>(width, false));
+// Function to detect faces and create a mask
+SkinMask detectFacesAndCreateMask(const cv::Mat &gray_frame, uint32_t scale, uint32_t width, uint32_t height,
+				  std::vector<struct vec4> &face_coordinates, std::vector<struct vec4> &skin_regions,
+				  const MaskRect *previous_face, enum face_detector detector)
+{
+	std::lock_guard<std::mutex> lock(cascade_mutex);
 
-	// Create an OpenCV Mat for the BGRA frame
-	// `linesize` specifies the number of bytes per row, which can include padding
-	cv::Mat bgra_frame(height, linesize / 4, CV_8UC4, data);
+	// Initialize the face cascade
+	initializeFaceCascade(detector);
+	cv::CascadeClassifier &cascade = detector == FACE_DETECTOR_LBP ? lbp_face_cascade : face_cascade;
+	const FaceCascadeSettings &settings = faceCascadeSettings(detector);
 
-	// Crop to remove padding if linesize > width * 4
-	cv::Mat cropped_bgra_frame = bgra_frame(cv::Rect(0, 0, width, height));
+	// The face minus its eyes and mouth, empty until a face is found
+	SkinMask face_mask(width, height);
 
-	// Convert BGRA to BGR (OpenCV processes images in BGR format)
-	cv::Mat bgr_frame;
-	cv::cvtColor(cropped_bgra_frame, bgr_frame, cv::COLOR_BGRA2BGR);
+	// Rectangles are found in the grayscale image and scaled back to the frame
+	const int factor = static_cast<int>(scale);
+	// Smallest sizes are given at frame resolution, and are raised to the window of the cascade, below which it
+	// finds nothing
+	auto minSize = [&](int min_width, int min_height) {
+		return cv::Size(std::max(min_width / factor, settings.windowSize),
+				std::max(min_height / factor, settings.windowSize));
+	};
 
 	// Detect faces
 	std::vector<cv::Rect> faces;
-	face_cascade.detectMultiScale(bgr_frame, faces, 1.1, 10, 0, cv::Size(30, 30));
+	if (previous_face) {
+		// Faces within 30% of the size of the previous one
+		int side = 0;
+		cv::Rect window = searchWindow(*previous_face, factor, gray_frame.size(), side);
+		cv::Size smallest(std::max(side * 7 / 10, 1), std::max(side * 7 / 10, 1));
+		cv::Size largest(side * 13 / 10, side * 13 / 10);
+		if (!window.empty() && side > 0) {
+			cascade.detectMultiScale(gray_frame(window), faces, settings.scaleFactor, settings.minNeighbors,
+						 0, smallest, largest);
+		}
+		for (cv::Rect &face : faces) {
+			face.x += window.x;
+			face.y += window.y;
+		}
+	} else {
+		cascade.detectMultiScale(gray_frame, faces, settings.scaleFactor, settings.minNeighbors, 0,
+					 minSize(30, 30));
+	}
 
 	// Detect eyes and mouth within detected faces
 	for (size_t i = 0; i < faces.size(); i++) {
-		face_coordinates.push_back(getNormalisedRect(faces[i], width, height));
+		if (detector == FACE_DETECTOR_LBP) {
+			// Skip the eye and mouth cascades
+			std::vector<cv::Rect> exclusions;
+			addGeometricExclusions(faces[i], exclusions);
+			addFace(faces[i], exclusions, i == 0, factor, width, height, face_mask, face_coordinates,
+				skin_regions);
+			continue;
+		}
 
-		// Define region of interest (ROI) for eyes and mouth
-		cv::Mat faceROI = bgr_frame(faces[i]);
+		// Region of interest (ROI) for eyes and mouth: the face resampled to the canonical size
+		const cv::Rect &face = faces[i];
 		cv::Mat gray_faceROI;
-		cv::cvtColor(faceROI, gray_faceROI, cv::COLOR_BGR2GRAY);
+		cv::resize(gray_frame(face), gray_faceROI, cv::Size(CANONICAL_FACE_SIZE, CANONICAL_FACE_SIZE), 0, 0,
+			   face.width > CANONICAL_FACE_SIZE ? cv::INTER_AREA : cv::INTER_LINEAR);
 		cv::Mat upperFaceROI =
 			gray_faceROI(cv::Rect(0, 0, gray_faceROI.cols, gray_faceROI.rows / 2)); // Upper half
 		cv::Mat lowerFaceROI = gray_faceROI(
-			cv::Rect(0, gray_faceROI.rows / 2, gray_faceROI.cols, faceROI.rows / 2)); // Lower half
+			cv::Rect(0, gray_faceROI.rows / 2, gray_faceROI.cols, gray_faceROI.rows / 2)); // Lower half
 
-		// Detect left eyes
+		// Rectangle of the canonical face, rows_above rows below its top, back in the grayscale image
+		double scale_x = static_cast<double>(face.width) / CANONICAL_FACE_SIZE;
+		double scale_y = static_cast<double>(face.height) / CANONICAL_FACE_SIZE;
+		auto fromCanonical = [&](const cv::Rect &rect, int rows_above) {
+			int left = face.x + cvRound(rect.x * scale_x);
+			int top = face.y + cvRound((rect.y + rows_above) * scale_y);
+			return cv::Rect(left, top, cvRound(rect.width * scale_x), cvRound(rect.height * scale_y));
+		};
+
+		// Absolute eye and mouth rectangles in the grayscale image, which are excluded from the skin mask
+		std::vector<cv::Rect> exclusions;
+
+		// Detect left eyes. On the canonical face the cascades search from their own window size up, which
+		// covers every eye and mouth of a face that size
 		std::vector<cv::Rect> left_eyes;
-		left_eye_cascade.detectMultiScale(upperFaceROI, left_eyes, 1.1, 10, 0, cv::Size(15, 15));
-		std::vector<vec4> left_eye_rects;
+		left_eye_cascade.detectMultiScale(upperFaceROI, left_eyes, 1.1, 10, 0);
 		for (size_t j = 0; j < std::min(static_cast<size_t>(1), left_eyes.size()); j++) {
-			const auto &eye = left_eyes[j];
 			// Calculate absolute coordinates for the eye
-			cv::Rect absolute_eye(eye.x + faces[j].x, eye.y + faces[j].y, eye.width, eye.height);
-
-			// Push absolute eye bounding box as normalized coordinates
-			face_coordinates.push_back(getNormalisedRect(absolute_eye, width, height));
+			cv::Rect absolute_eye = fromCanonical(left_eyes[j], 0);
+			exclusions.push_back(absolute_eye);
 		}
 
 		// Detect right eyes
 		std::vector<cv::Rect> right_eyes;
-		right_eye_cascade.detectMultiScale(upperFaceROI, right_eyes, 1.1, 10, 0, cv::Size(15, 15));
-		std::vector<vec4> right_eye_rects;
+		right_eye_cascade.detectMultiScale(upperFaceROI, right_eyes, 1.1, 10, 0);
 		for (size_t j = 0; j < std::min(static_cast<size_t>(1), right_eyes.size()); j++) {
-			const auto &eye = right_eyes[j];
 			// Calculate absolute coordinates for the eye
-			cv::Rect absolute_eye(eye.x + faces[j].x, eye.y + faces[j].y, eye.width, eye.height);
-
-			// Push absolute eye bounding box as normalized coordinates
-			face_coordinates.push_back(getNormalisedRect(absolute_eye, width, height));
+			cv::Rect absolute_eye = fromCanonical(right_eyes[j], 0);
+			exclusions.push_back(absolute_eye);
 		}
 
 		// Detect mouth in the lower half of the face ROI
 		std::vector<cv::Rect> mouths;
-		mouth_cascade.detectMultiScale(lowerFaceROI, mouths, 1.05, 35, 0, cv::Size(30, 15));
-		std::vector<vec4> mouth_rects;
+		mouth_cascade.detectMultiScale(lowerFaceROI, mouths, 1.05, 35, 0);
 		for (size_t j = 0; j < std::min(static_cast<size_t>(1), mouths.size()); j++) {
-			const auto &mouth = mouths[j];
 			// Calculate absolute coordinates for the mouth
-			cv::Rect absolute_mouth(mouth.x + faces[j].x, mouth.y + faces[j].y + faceROI.rows / 2,
-						mouth.width, mouth.height);
-
-			// Push absolute mouth bounding box as normalized coordinates
-			face_coordinates.push_back(getNormalisedRect(absolute_mouth, width, height));
+			cv::Rect absolute_mouth = fromCanonical(mouths[j], gray_faceROI.rows / 2);
+			exclusions.push_back(absolute_mouth);
 		}
 
-		if (i == 0) {
-			// Mark pixels within detected face regions as true
-			mask_face(face_mask, faces[0], true);
-			// Mark pixels within detected eye regions as false
-			if (left_eyes.size() > 0) {
-				mask_face(face_mask, left_eyes[0], false);
-			}
-			if (right_eyes.size() > 0) {
-				mask_face(face_mask, right_eyes[0], false);
-			}
-			for (size_t j = 0; j < std::min(static_cast<size_t>(1), mouths.size()); j++) {
-				// Mark pixels within detected mouth region as false
-				mask_face(face_mask, mouths[j], false);
-			}
-		}
+		addFace(face, exclusions, i == 0, factor, width, height, face_mask, face_coordinates, skin_regions);
 	}
 
 	return face_mask;
 }
+
+const char *faceDetectorName(enum face_detector detector)
+{
+	return detector == FACE_DETECTOR_LBP ? "LBP" : "Haar";
+}
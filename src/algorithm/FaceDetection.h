@@ -12,8 +12,33 @@
 #include <stdexcept>
 
 #include "heart_rate_source.h"
+#include "SkinMask.h"
 
-std::vector<std::vector<bool>> detectFacesAndCreateMask(struct input_BGRA_data *frame,
-							std::vector<struct vec4> &face_coordinates);
+// Face cascade of a detector: its file in the plugin data, the step between the face sizes it searches, the
+// overlapping hits a face needs to be kept, and the side in pixels of its window, the smallest face it can find
+struct FaceCascadeSettings {
+	const char *file;
+	double scaleFactor;
+	int minNeighbors;
+	int windowSize;
+};
+
+// Face cascade of the detector, the LBP one or the Haar one
+const FaceCascadeSettings &faceCascadeSettings(enum face_detector detector);
+
+// Detect faces in a grayscale image of the frame downscaled by scale in both directions, such as the one made by
+// sumSpansAndDownscaleGray, and return the skin mask of the first one. The normalised rectangles of every face, eye
+// and mouth, scaled back to the width x height frame, are appended to face_coordinates, and the rectangles making up
+// the mask are written to skin_regions: the face first, followed by the eye and mouth rectangles excluded from it.
+// Given the face of an earlier detection, in pixels of the frame, only a window around it is searched, for faces
+// within 30% of its size. FACE_DETECTOR_LBP runs the LBP face cascade alone and places the eye and mouth rectangles
+// geometrically, FACE_DETECTOR_HAAR runs the four Haar cascades
+SkinMask detectFacesAndCreateMask(const cv::Mat &gray_frame, uint32_t scale, uint32_t width, uint32_t height,
+				  std::vector<struct vec4> &face_coordinates, std::vector<struct vec4> &skin_regions,
+				  const MaskRect *previous_face = nullptr,
+				  enum face_detector detector = FACE_DETECTOR_HAAR);
+
+// Name of the detector for the logs
+const char *faceDetectorName(enum face_detector detector);
 
 #endif
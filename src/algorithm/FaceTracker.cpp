@@ -0,0 +1,171 @@
+#include "FaceTracker.h"
+#include "FrameStatistics.h"
+
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+#include <util/platform.h>
+
+// Most corner features tracked, and the window and pyramid levels of the optical flow
+#define TRACKER_MAX_FEATURES 50
+#define TRACKER_WINDOW 15
+#define TRACKER_LEVELS 2
+
+static float median(std::vector<float> &values)
+{
+	auto middle = values.begin() + values.size() / 2;
+	std::nth_element(values.begin(), middle, values.end());
+	return *middle;
+}
+
+// Downscale the tracked area of the frame, only its luma or packed plane is read
+void FaceTracker::makeGray(const ImageView &frame, ThreadPool &pool, cv::Mat &gray) const
+{
+	ImageView view = frame;
+	view.data = frame.row(static_cast<uint32_t>(area.y)) + static_cast<size_t>(area.x) * frame.bytesPerPixel();
+	view.width = static_cast<uint32_t>(area.width);
+	view.height = static_cast<uint32_t>(area.height);
+	view.chroma[0] = nullptr;
+	view.chroma[1] = nullptr;
+	downscaleGray(view, scale, pool, gray);
+}
+
+bool FaceTracker::start(const ImageView &frame, const MaskRect &face, ThreadPool &pool)
+{
+	tracking = false;
+	if (frame.empty() || face.width <= 0 || face.height <= 0) {
+		return false;
+	}
+
+	// Largest power of two that keeps the face at least TRACKER_FACE_SIZE pixels across
+	scale = 1;
+	int32_t side = std::max(face.width, face.height);
+	while (side / static_cast<int32_t>(scale * 2) >= TRACKER_FACE_SIZE) {
+		scale *= 2;
+	}
+
+	// The face with half its size around it to move in, clipped to the frame and to whole blocks of the scale. An
+	// even left edge keeps the pixel pairs of packed YUV whole
+	int32_t step = static_cast<int32_t>(scale);
+	int32_t left = std::max(face.x - face.width / 2, 0) & ~1;
+	int32_t top = std::max(face.y - face.height / 2, 0);
+	int32_t right = std::min(face.x + face.width + face.width / 2, static_cast<int32_t>(frame.width));
+	int32_t bottom = std::min(face.y + face.height + face.height / 2, static_cast<int32_t>(frame.height));
+	area.x = left;
+	area.y = top;
+	area.width = (right - left) / step * step;
+	area.height = (bottom - top) / step * step;
+	if (area.width < TRACKER_WINDOW * step || area.height < TRACKER_WINDOW * step) {
+		return false;
+	}
+	makeGray(frame, pool, previousGray);
+
+	// Corners of the inner face only, its edges show the background which does not move with it
+	cv::Mat mask = cv::Mat::zeros(previousGray.size(), CV_8UC1);
+	cv::Rect inner((face.x + face.width / 10 - area.x) / step, (face.y + face.height / 10 - area.y) / step,
+		       face.width * 8 / 10 / step, face.height * 8 / 10 / step);
+	mask(inner & cv::Rect(0, 0, mask.cols, mask.rows)).setTo(255);
+	cv::goodFeaturesToTrack(previousGray, previousPoints, TRACKER_MAX_FEATURES, 0.01, 3.0, mask);
+	if (previousPoints.size() < TRACKER_MIN_FEATURES) {
+		return false;
+	}
+
+	frameWidth = frame.width;
+	frameHeight = frame.height;
+	startX = faceX = static_cast<float>(face.x);
+	startY = faceY = static_cast<float>(face.y);
+	startWidth = faceWidth = static_cast<float>(face.width);
+	startHeight = faceHeight = static_cast<float>(face.height);
+	tracking = true;
+	return true;
+}
+
+bool FaceTracker::track(const ImageView &frame, ThreadPool &pool)
+{
+	if (!tracking) {
+		return false;
+	}
+	if (frame.width != frameWidth || frame.height != frameHeight) {
+		tracking = false;
+		stats.losses++;
+		return false;
+	}
+
+	uint64_t start = os_gettime_ns();
+	makeGray(frame, pool, currentGray);
+
+	const cv::Size window(TRACKER_WINDOW, TRACKER_WINDOW);
+	cv::calcOpticalFlowPyrLK(previousGray, currentGray, previousPoints, currentPoints, status, errors, window,
+				 TRACKER_LEVELS);
+	cv::calcOpticalFlowPyrLK(currentGray, previousGray, currentPoints, backPoints, backStatus, errors, window,
+				 TRACKER_LEVELS);
+
+	// Keep the features that come back to within a pixel of where they started
+	size_t kept = 0;
+	shiftsX.clear();
+	shiftsY.clear();
+	for (size_t i = 0; i < previousPoints.size(); i++) {
+		cv::Point2f roundTrip = backPoints[i] - previousPoints[i];
+		if (!status[i] || !backStatus[i] || roundTrip.dot(roundTrip) > 1.0f) {
+			continue;
+		}
+		shiftsX.push_back(currentPoints[i].x - previousPoints[i].x);
+		shiftsY.push_back(currentPoints[i].y - previousPoints[i].y);
+		previousPoints[kept] = previousPoints[i];
+		currentPoints[kept] = currentPoints[i];
+		kept++;
+	}
+	previousPoints.resize(kept);
+	currentPoints.resize(kept);
+
+	bool followed = kept >= TRACKER_MIN_FEATURES;
+	if (followed) {
+		// The face scales by the median change of the distances between features
+		ratios.clear();
+		for (size_t i = 0; i < kept; i++) {
+			for (size_t j = i + 1; j < kept; j++) {
+				float before = static_cast<float>(cv::norm(previousPoints[i] - previousPoints[j]));
+				if (before > 2.0f) {
+					ratios.push_back(static_cast<float>(
+						cv::norm(currentPoints[i] - currentPoints[j]) / before));
+				}
+			}
+		}
+		float ratio = ratios.empty() ? 1.0f : median(ratios);
+
+		float centreX = faceX + faceWidth / 2 + median(shiftsX) * scale;
+		float centreY = faceY + faceHeight / 2 + median(shiftsY) * scale;
+		faceWidth *= ratio;
+		faceHeight *= ratio;
+		faceX = centreX - faceWidth / 2;
+		faceY = centreY - faceHeight / 2;
+
+		// Beyond its area the face would no longer be in the images
+		followed = faceX >= area.x && faceY >= area.y && faceX + faceWidth <= area.x + area.width &&
+			   faceY + faceHeight <= area.y + area.height;
+	}
+
+	stats.totalTrackNs += os_gettime_ns() - start;
+	if (!followed) {
+		tracking = false;
+		stats.losses++;
+		return false;
+	}
+
+	std::swap(previousGray, currentGray);
+	std::swap(previousPoints, currentPoints);
+	stats.trackedFrames++;
+	return true;
+}
+
+struct vec4 FaceTracker::mapRegion(const struct vec4 &region, uint32_t width, uint32_t height) const
+{
+	float scaleX = faceWidth / startWidth;
+	float scaleY = faceHeight / startHeight;
+	auto mapX = [&](float x) { return (faceX + (x * width - startX) * scaleX) / width; };
+	auto mapY = [&](float y) { return (faceY + (y * height - startY) * scaleY) / height; };
+
+	struct vec4 mapped;
+	vec4_set(&mapped, mapX(region.x), mapX(region.y), mapY(region.z), mapY(region.w));
+	return mapped;
+}
@@ -0,0 +1,81 @@
+#ifndef FACE_TRACKER_H
+#define FACE_TRACKER_H
+
+#include <cstdint>
+#include <vector>
+#include <obs.h>
+#include <opencv2/core.hpp>
+
+#include "ImageView.h"
+#include "SkinMask.h"
+#include "ThreadPool.h"
+
+// Size in pixels the face is downscaled to, at least, in the grayscale images it is tracked in
+#define TRACKER_FACE_SIZE 64
+// Fewest features that must follow the face for the tracking to be trusted
+#define TRACKER_MIN_FEATURES 8
+
+// Statistics of the tracking of one MovingAvg
+struct TrackerStats {
+	uint64_t trackedFrames = 0;
+	uint64_t losses = 0;
+	// Time all tracked frames took, in nanoseconds
+	uint64_t totalTrackNs = 0;
+};
+
+// Follows a face from one frame to the next between detections, with pyramidal Lucas-Kanade optical flow on corner
+// features found inside the face box. Features are only kept when tracking them back to the previous frame lands
+// within a pixel of where they started, and the face moves and scales by the median of their motion. The tracking
+// runs on a small grayscale image of the area around the face, made straight from the frame in any format with pixel
+// format traits, so a frame costs a fraction of a millisecond. It stops as soon as too few features survive or the
+// face leaves that area, and a detection is then needed to start it again
+class FaceTracker {
+private:
+	bool tracking = false;
+
+	// Size of the frames tracked in, and the area of them the grayscale images cover, downscaled by a power of two
+	uint32_t frameWidth = 0;
+	uint32_t frameHeight = 0;
+	MaskRect area;
+	uint32_t scale = 1;
+
+	cv::Mat previousGray;
+	cv::Mat currentGray;
+	// Features in grayscale image coordinates, with the buffers of their flow kept between frames
+	std::vector<cv::Point2f> previousPoints;
+	std::vector<cv::Point2f> currentPoints;
+	std::vector<cv::Point2f> backPoints;
+	std::vector<uchar> status;
+	std::vector<uchar> backStatus;
+	std::vector<float> errors;
+	std::vector<float> shiftsX;
+	std::vector<float> shiftsY;
+	std::vector<float> ratios;
+
+	// Face rectangle at the start of the tracking and now, in frame pixels
+	float startX = 0.0f, startY = 0.0f, startWidth = 0.0f, startHeight = 0.0f;
+	float faceX = 0.0f, faceY = 0.0f, faceWidth = 0.0f, faceHeight = 0.0f;
+
+	TrackerStats stats;
+
+	void makeGray(const ImageView &frame, ThreadPool &pool, cv::Mat &gray) const;
+
+public:
+	// Start tracking the face, given in pixels of the frame, returns false if it has too few features to track
+	bool start(const ImageView &frame, const MaskRect &face, ThreadPool &pool);
+
+	// Follow the face into the frame. Returns false, and stops tracking, when the face was lost
+	bool track(const ImageView &frame, ThreadPool &pool);
+
+	void stop() { tracking = false; }
+
+	bool isTracking() const { return tracking; }
+
+	// Move a normalised rectangle (min x, max x, min y, max y) of the frame the tracking started on with the face,
+	// keeping its position relative to the face
+	struct vec4 mapRegion(const struct vec4 &region, uint32_t width, uint32_t height) const;
+
+	TrackerStats getStats() const { return stats; }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "FrameConversion.h"
+
+#include <cstring>
+
+bool isAsyncFormatSupported(enum video_format format)
+{
+	switch (format) {
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+	case VIDEO_FORMAT_RGBA:
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_UYVY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool isYUVFormat(enum video_format format)
+{
+	switch (format) {
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_UYVY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Copy the rows of one plane, rowSize bytes each, into a tightly packed destination
+static uint8_t *copyPlane(uint8_t *dst, const uint8_t *src, uint32_t linesize, uint32_t rowSize, uint32_t rows)
+{
+	for (uint32_t y = 0; y < rows; ++y) {
+		memcpy(dst + static_cast<size_t>(y) * rowSize, src + static_cast<size_t>(y) * linesize, rowSize);
+	}
+	return dst + static_cast<size_t>(rowSize) * rows;
+}
+
+void copySourceFrame(const struct obs_source_frame *frame, struct input_BGRA_data *BGRA_data)
+{
+	uint32_t width = frame->width;
+	uint32_t height = frame->height;
+	uint32_t chroma_width = (width + 1) / 2;
+	uint32_t chroma_height = (height + 1) / 2;
+
+	// Row size in bytes of the luma or packed plane, and of the chroma planes
+	uint32_t row_size;
+	uint32_t chroma_row_size = 0;
+	int chroma_planes = 0;
+	switch (frame->format) {
+	case VIDEO_FORMAT_NV12:
+		row_size = width;
+		chroma_row_size = chroma_width * 2;
+		chroma_planes = 1;
+		break;
+	case VIDEO_FORMAT_I420:
+		row_size = width;
+		chroma_row_size = chroma_width;
+		chroma_planes = 2;
+		break;
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_UYVY:
+		row_size = chroma_width * 4;
+		break;
+	default:
+		row_size = width * 4;
+		break;
+	}
+
+	uint8_t *dst = BGRA_data->data;
+	dst = copyPlane(dst, frame->data[0], frame->linesize[0], row_size, height);
+	BGRA_data->linesize = row_size;
+	for (int i = 0; i < 2; i++) {
+		BGRA_data->chroma[i] = nullptr;
+		BGRA_data->chroma_linesize[i] = 0;
+		if (i < chroma_planes) {
+			BGRA_data->chroma[i] = dst;
+			BGRA_data->chroma_linesize[i] = chroma_row_size;
+			dst = copyPlane(dst, frame->data[i + 1], frame->linesize[i + 1], chroma_row_size,
+					chroma_height);
+		}
+	}
+
+	BGRA_data->format = frame->format;
+	memcpy(BGRA_data->color_matrix, frame->color_matrix, sizeof(BGRA_data->color_matrix));
+}
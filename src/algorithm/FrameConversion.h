@@ -0,0 +1,19 @@
+#ifndef FRAME_CONVERSION_H
+#define FRAME_CONVERSION_H
+
+#include <obs-module.h>
+
+#include "heart_rate_source.h"
+
+// Whether frames of this format can be analysed directly on the async video path, in their own layout and without a
+// colour conversion
+bool isAsyncFormatSupported(enum video_format format);
+
+// Whether the format is one of the planar or packed YUV layouts the averaging kernels understand
+bool isYUVFormat(enum video_format format);
+
+// Copy the planes of an async source frame of a supported format, packed one after the other, into a pooled frame
+// of the same size. The pooled BGRA buffer is large enough for the planes of every supported format
+void copySourceFrame(const struct obs_source_frame *frame, struct input_BGRA_data *BGRA_data);
+
+#endif
@@ -0,0 +1,197 @@
+#include "FrameStatistics.h"
+#include "PixelFormat.h"
+
+#include <algorithm>
+
+using namespace std;
+
+SampleLattice jitteredLattice(uint64_t maskPixels, uint32_t minSamples, uint64_t index)
+{
+	SampleLattice lattice;
+	if (minSamples == 0 || maskPixels < 4 * static_cast<uint64_t>(minSamples)) {
+		return lattice;
+	}
+
+	lattice.step = static_cast<uint32_t>(sqrt(static_cast<double>(maskPixels) / minSamples));
+	uint32_t jitter = static_cast<uint32_t>(index) * 2654435761u;
+	lattice.phaseX = (jitter >> 8) % lattice.step;
+	lattice.phaseY = (jitter >> 20) % lattice.step;
+	return lattice;
+}
+
+struct YUVSums {
+	uint64_t y = 0;
+	uint64_t u = 0;
+	uint64_t v = 0;
+	uint64_t count = 0;
+};
+
+// Accumulate the Y, U, V of every masked pixel, one compiled row span at a time. The traits return the three
+// components of pixel (x, y) for the layout of the frame, so each layout gets its own inlined loop. Bands of spans
+// are summed in parallel into their own slots, which are added in band order
+template<typename Traits>
+static void sumMaskedYUV(const ImageView &frame, const CompiledSkinMask &skinMask, ThreadPool &pool,
+			 const SampleLattice &lattice, YUVSums &sums)
+{
+	const vector<CompiledSpan> &spans = skinMask.getSpans();
+
+	if (lattice.step > 1) {
+		// Few enough pixels to sample on this thread
+		for (const CompiledSpan &span : spans) {
+			if (!lattice.sampledRow(span.y)) {
+				continue;
+			}
+			uint32_t end = span.x + span.length;
+			for (uint32_t x = span.x + lattice.firstFrom(span.x); x < end; x += lattice.step) {
+				uint8_t Y, U, V;
+				Traits::sample(frame, x, span.y, Y, U, V);
+				sums.y += Y;
+				sums.u += U;
+				sums.v += V;
+				sums.count++;
+			}
+		}
+		return;
+	}
+
+	// Per-band state on the stack, the pool never has more than MAX_ANALYSIS_THREADS threads
+	size_t bounds[MAX_ANALYSIS_THREADS + 1];
+	size_t bands = skinMask.splitBands(pool.size(), bounds);
+	YUVSums bandSums[MAX_ANALYSIS_THREADS];
+
+	pool.parallelFor(bands, [&](size_t band) {
+		YUVSums &bandSum = bandSums[band];
+		for (size_t i = bounds[band]; i < bounds[band + 1]; i++) {
+			const CompiledSpan &span = spans[i];
+			for (uint32_t x = span.x; x < span.x + span.length; ++x) {
+				uint8_t Y, U, V;
+				Traits::sample(frame, x, span.y, Y, U, V);
+				bandSum.y += Y;
+				bandSum.u += U;
+				bandSum.v += V;
+			}
+		}
+	});
+
+	for (size_t band = 0; band < bands; band++) {
+		const YUVSums &bandSum = bandSums[band];
+		sums.y += bandSum.y;
+		sums.u += bandSum.u;
+		sums.v += bandSum.v;
+	}
+	sums.count = skinMask.count();
+}
+
+ColorMean averageYUV(const ImageView &frame, const CompiledSkinMask &skinMask, ThreadPool &pool,
+		     const SampleLattice &lattice)
+{
+	YUVSums sums;
+	dispatchPixelFormat(frame.format, [&](auto traits) {
+		using Traits = decltype(traits);
+		if constexpr (Traits::yuv) {
+			sumMaskedYUV<Traits>(frame, skinMask, pool, lattice, sums);
+		}
+	});
+
+	if (sums.count == 0) {
+		return {0.0, 0.0, 0.0};
+	}
+
+	// The colour matrix works on components normalised to [0, 1] and produces normalised RGB
+	double meanY = static_cast<double>(sums.y) / sums.count / 255.0;
+	double meanU = static_cast<double>(sums.u) / sums.count / 255.0;
+	double meanV = static_cast<double>(sums.v) / sums.count / 255.0;
+
+	ColorMean rgb;
+	for (int i = 0; i < 3; i++) {
+		const float *row = frame.colorMatrix + i * 4;
+		double value = row[0] * meanY + row[1] * meanU + row[2] * meanV + row[3];
+		rgb[i] = std::min(std::max(value, 0.0), 1.0) * 255.0;
+	}
+
+	return rgb;
+}
+
+// Box filter the luma of the frame down by scale into gray, bands of gray rows in parallel. With a skin mask, the
+// B, G, R sums of its spans are also added to sums, each group of scale rows right after its luma while the rows
+// are still in cache
+template<typename Traits>
+static void downscaleGrayRows(const ImageView &frame, const CompiledSkinMask *skinMask, uint32_t scale,
+			      ThreadPool &pool, ChannelSums &sums, cv::Mat &gray)
+{
+	uint32_t grayWidth = frame.width / scale;
+	uint32_t grayHeight = frame.height / scale;
+	gray.create(static_cast<int>(grayHeight), static_cast<int>(grayWidth), CV_8UC1);
+
+	static const vector<CompiledSpan> noSpans;
+	const vector<CompiledSpan> &spans = skinMask ? skinMask->getSpans() : noSpans;
+	BGRASpanSumKernel sumSpan = getBGRASpanSumKernel();
+	// Each gray pixel is the rounded mean of a scale x scale block of fixed-point luma
+	uint64_t divisor = static_cast<uint64_t>(scale) * scale << GRAY_WEIGHT_SHIFT;
+	uint64_t rounding = divisor / 2;
+
+	size_t bands = std::max<size_t>(std::min<size_t>(pool.size(), grayHeight), 1);
+	ChannelSums bandSums[MAX_ANALYSIS_THREADS];
+
+	pool.parallelFor(bands, [&](size_t band) {
+		uint32_t firstRow = static_cast<uint32_t>(grayHeight * band / bands);
+		uint32_t lastRow = static_cast<uint32_t>(grayHeight * (band + 1) / bands);
+		// The last band also takes the rows left over below the last full block
+		uint32_t frameRowsEnd = band + 1 == bands ? frame.height : lastRow * scale;
+
+		auto span = std::lower_bound(spans.begin(), spans.end(), firstRow * scale,
+					     [](const CompiledSpan &s, uint32_t y) { return s.y < y; });
+		auto sumSpansBefore = [&](uint32_t rowEnd) {
+			for (; span != spans.end() && span->y < rowEnd; ++span) {
+				sumSpan(frame.data + span->offset, span->length, bandSums[band]);
+			}
+		};
+
+		for (uint32_t gy = firstRow; gy < lastRow; ++gy) {
+			uint8_t *out = gray.ptr<uint8_t>(static_cast<int>(gy));
+			for (uint32_t gx = 0; gx < grayWidth; ++gx) {
+				uint64_t weighted = 0;
+				for (uint32_t dy = 0; dy < scale; ++dy) {
+					const uint8_t *row = frame.row(gy * scale + dy);
+					for (uint32_t dx = 0; dx < scale; ++dx) {
+						weighted += Traits::grayFixed(row, gx * scale + dx);
+					}
+				}
+				out[gx] = static_cast<uint8_t>((weighted + rounding) / divisor);
+			}
+			sumSpansBefore((gy + 1) * scale);
+		}
+		sumSpansBefore(frameRowsEnd);
+	});
+
+	for (size_t band = 0; band < bands; band++) {
+		const ChannelSums &bandSum = bandSums[band];
+		sums.b += bandSum.b;
+		sums.g += bandSum.g;
+		sums.r += bandSum.r;
+	}
+}
+
+void sumSpansAndDownscaleGray(const ImageView &frame, const CompiledSkinMask &skinMask, uint32_t scale,
+			      ThreadPool &pool, ChannelSums &sums, cv::Mat &gray)
+{
+	dispatchPixelFormat(frame.format, [&](auto traits) {
+		using Traits = decltype(traits);
+		if constexpr (!Traits::yuv) {
+			ChannelSums frameSums;
+			downscaleGrayRows<Traits>(frame, &skinMask, scale, pool, frameSums, gray);
+			Traits::orderSums(frameSums);
+			sums.b += frameSums.b;
+			sums.g += frameSums.g;
+			sums.r += frameSums.r;
+		}
+	});
+}
+
+void downscaleGray(const ImageView &frame, uint32_t scale, ThreadPool &pool, cv::Mat &gray)
+{
+	dispatchPixelFormat(frame.format, [&](auto traits) {
+		ChannelSums unused;
+		downscaleGrayRows<decltype(traits)>(frame, nullptr, scale, pool, unused, gray);
+	});
+}
@@ -0,0 +1,54 @@
+#ifndef FRAME_STATISTICS_H
+#define FRAME_STATISTICS_H
+
+#include <array>
+#include <cmath>
+#include <vector>
+#include <obs.h>
+#include <opencv2/core.hpp>
+
+#include "ChannelSums.h"
+#include "ImageView.h"
+#include "SkinMask.h"
+#include "ThreadPool.h"
+
+// Mean R, G, B of the skin of a frame, in 8-bit levels. A fixed size array so that a frame's mean never allocates
+using ColorMean = std::array<double_t, 3>;
+
+// Lattice of every step-th pixel of every step-th row, shifted by a phase the caller varies from frame to frame so
+// that successive frames sample different pixels. A step of 1 samples every pixel
+struct SampleLattice {
+	uint32_t step = 1;
+	uint32_t phaseX = 0;
+	uint32_t phaseY = 0;
+
+	bool sampledRow(uint32_t y) const { return (y + phaseY) % step == 0; }
+
+	// Offset from x of the first sampled pixel at or after it
+	uint32_t firstFrom(uint32_t x) const { return (step - (x + phaseX) % step) % step; }
+};
+
+// Lattice of the index-th subsampled frame of a mask of maskPixels pixels, with the coarsest step that keeps at least
+// minSamples of them and a phase that moves every frame so that over a few frames every pixel is sampled. Every pixel
+// is sampled when minSamples is 0 or the mask has fewer than 4 * minSamples pixels
+SampleLattice jitteredLattice(uint64_t maskPixels, uint32_t minSamples, uint64_t index);
+
+// Masked mean R, G, B of a NV12, I420, YUY2 or UYVY frame. The skin mask is at luma resolution; every masked luma
+// pixel contributes its own Y and the U, V of the chroma sample covering it. The mean Y, U, V are converted to RGB
+// once with the frame's colour matrix, which matches a per-pixel conversion because the conversion is affine. The
+// spans are summed in bands on the pool, or only on the pixels of the lattice when it is coarser than every pixel
+ColorMean averageYUV(const ImageView &frame, const CompiledSkinMask &skinMask, ThreadPool &pool,
+		     const SampleLattice &lattice = SampleLattice());
+
+// One pass over a BGRA, BGRX or RGBA frame that both adds the B, G, R sums of the compiled skin spans to sums and
+// box filters the luma of the frame down by an integer scale in each direction into gray, for frames on which a
+// detection is due. The frame is walked scale rows at a time, and the spans of those rows are summed right after
+// their luma, while they are still in cache. Bands of rows run in parallel on the pool. YUV frames are left alone
+void sumSpansAndDownscaleGray(const ImageView &frame, const CompiledSkinMask &skinMask, uint32_t scale,
+			      ThreadPool &pool, ChannelSums &sums, cv::Mat &gray);
+
+// Box filter the luma of a frame of any format with pixel format traits down by an integer scale into gray.
+// The luma plane of YUV frames is averaged as it is
+void downscaleGray(const ImageView &frame, uint32_t scale, ThreadPool &pool, cv::Mat &gray);
+
+#endif
@@ -1,134 +1,214 @@
+#include "AllocationCounter.h"
+#include "ChannelSums.h"
 #include "FaceDetection.h"
+#include "FrameConversion.h"
+#include "FrameStatistics.h"
+#include "PixelFormat.h"
 #include <obs-module.h>
+#include <util/platform.h>
 #include "plugin-support.h"
 #include "HeartRateAlgorithm.h"
 #include <fstream>
 #include <string>
 #include <cstdlib>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 
 using namespace std;
 using namespace Eigen;
-using FrameRGB = vector<vector<vector<uint8_t>>>;
-using Windows = vector<vector<vector<double_t>>>;
-using Window = vector<vector<double_t>>;
-
-// Calculating the average/mean RGB values of a frame
-vector<double_t> MovingAvg::averageRGB(FrameRGB rgb, vector<vector<bool>> skinKey)
-{
-	double sumR = 0.0, sumG = 0.0, sumB = 0.0;
-	double count = 0;
-
-	// Iterate through the frame pixels using the key
-	for (int i = 0; i < static_cast<int>(rgb.size()); ++i) {
-		for (int j = 0; j < static_cast<int>(rgb[0].size()); ++j) {
-			if (skinKey.empty()) {
-				sumR += rgb[i][j][0];
-				sumG += rgb[i][j][1];
-				sumB += rgb[i][j][2];
-				count++;
-			} else {
-				if (skinKey[i][j]) {
-					sumR += rgb[i][j][0];
-					sumG += rgb[i][j][1];
-					sumB += rgb[i][j][2];
-					count++;
-				}
+using Window = vector<ColorMean>;
+
+// Welch estimate: FFT length, and length and overlap of the Hann windowed segments
+static const int welchFftSize = 2048;
+static const int welchSegmentSize = 256;
+static const int welchOverlap = 200;
+
+// Every buffer of the per-frame path is sized here from the configuration, so that only detections and mask
+// changes allocate once the resampler and compiled masks have grown to the frame
+MovingAvg::MovingAvg()
+{
+	windows.reserve(maxNumWindows);
+	spareWindows.reserve(maxNumWindows + 1);
+	for (int i = 0; i <= maxNumWindows; i++) {
+		spareWindows.emplace_back();
+		spareWindows.back().reserve(windowSize);
+	}
+	resamplerInput.reserve(3);
+	ppgSignal.reserve(static_cast<size_t>(maxNumWindows) * windowSize);
+
+	hannWindow.resize(welchSegmentSize);
+	for (int i = 0; i < welchSegmentSize; ++i) {
+		hannWindow[i] = 0.5 * (1 - std::cos(2 * M_PI * i / (welchSegmentSize - 1)));
+	}
+	segment.resize(welchSegmentSize);
+	segmentSpectrum.resize(welchSegmentSize);
+	psd.resize(welchFftSize / 2 + 1);
+	spectrumLog.reserve(8192);
+}
+
+// Calculating the average/mean RGB values of a BGRA, BGRX or RGBA frame, read in place through the view
+ColorMean MovingAvg::averageRGB(const ImageView &frame, const SkinMask &skinMask, const CompiledSkinMask &compiled,
+				const SampleLattice &lattice)
+{
+	ChannelSums sums;
+	uint64_t count = 0;
+
+	if (lattice.step > 1) {
+		// Only the sampled rows, and every step-th pixel on them
+		for (const CompiledSpan &span : compiled.getSpans()) {
+			if (!lattice.sampledRow(span.y)) {
+				continue;
+			}
+			uint32_t first = lattice.firstFrom(span.x);
+			if (first < span.length) {
+				count += sumBGRASpanStrided(frame.data + span.offset + static_cast<size_t>(first) * 4,
+							    span.length - first, lattice.step, sums);
+			}
+		}
+	} else if (useIntegralImage) {
+		integralImage.build(frame, pool);
+		count = integralImage.maskSum(skinMask, sums);
+	} else {
+		// Sum every compiled span of skin pixels with the SIMD kernel of this CPU, band by band in parallel
+		BGRASpanSumKernel sumSpan = getBGRASpanSumKernel();
+		const vector<CompiledSpan> &spans = compiled.getSpans();
+		size_t bandBounds[MAX_ANALYSIS_THREADS + 1];
+		size_t bands = compiled.splitBands(pool.size(), bandBounds);
+		ChannelSums bandSums[MAX_ANALYSIS_THREADS];
+		pool.parallelFor(bands, [&](size_t band) {
+			for (size_t i = bandBounds[band]; i < bandBounds[band + 1]; i++) {
+				sumSpan(frame.data + spans[i].offset, spans[i].length, bandSums[band]);
 			}
+		});
+		// Integer sums, so the result does not depend on the number of bands either
+		for (size_t band = 0; band < bands; band++) {
+			sums.b += bandSums[band].b;
+			sums.g += bandSums[band].g;
+			sums.r += bandSums[band].r;
 		}
+		count = compiled.count();
 	}
+	// Every path above sums bytes 0, 1 and 2 of the pixels, the traits of the format put them in channel order
+	dispatchPixelFormat(frame.format, [&](auto traits) {
+		using Traits = decltype(traits);
+		if constexpr (!Traits::yuv) {
+			Traits::orderSums(sums);
+		}
+	});
 	if (count > 0) {
-		return {sumR / count, sumG / count, sumB / count};
+		return {static_cast<double>(sums.r) / count, static_cast<double>(sums.g) / count,
+			static_cast<double>(sums.b) / count};
 	}
 
 	return {0.0, 0.0, 0.0};
 }
 
-vector<double_t> green(Window windowsRGB)
+// Append the green channel of the window to the signal, from its first-th sample on
+static void appendGreen(const Window &window, size_t first, vector<double_t> &signal)
+{
+	for (size_t i = first; i < window.size(); i++) {
+		signal.push_back(window[i][1]);
+	}
+}
+
+// An empty window with room for windowSize samples, a spare one unless none are left
+Window MovingAvg::takeWindow()
 {
-	vector<double_t> framesG;
-	for (int i = 0; i < static_cast<int>(windowsRGB.size()); i++) {
-		framesG.push_back(windowsRGB[i][1]);
+	if (spareWindows.empty()) {
+		Window window;
+		window.reserve(windowSize);
+		return window;
 	}
 
-	return framesG;
+	Window window = std::move(spareWindows.back());
+	spareWindows.pop_back();
+	window.clear();
+	return window;
 }
 
-void MovingAvg::updateWindows(vector<double_t> frame_avg)
+void MovingAvg::clearWindows()
 {
+	for (Window &window : windows) {
+		spareWindows.push_back(std::move(window));
+	}
+	windows.clear();
+}
+
+void MovingAvg::updateWindows(const vector<double_t> &frame_avg)
+{
+	ColorMean sample = {frame_avg[0], frame_avg[1], frame_avg[2]};
+
 	if (windows.empty()) {
-		windows.push_back({frame_avg});
+		windows.push_back(takeWindow());
+		windows.back().push_back(sample);
 		return;
 	}
 
-	Window last = windows.back();
+	Window &last = windows.back();
 
 	if (static_cast<int>(last.size()) == windowSize) {
-		Window newWindow = Window(last.end() - windowStride, last.end());
-		newWindow.push_back(frame_avg);
+		Window newWindow = takeWindow();
+		newWindow.assign(last.end() - windowStride, last.end());
+		newWindow.push_back(sample);
 		if (static_cast<int>(windows.size()) == maxNumWindows) {
+			// Moves the remaining windows down without copying their samples
+			spareWindows.push_back(std::move(windows.front()));
 			windows.erase(windows.begin());
 		}
-		windows.push_back(newWindow);
+		windows.push_back(std::move(newWindow));
 	} else {
-		windows.back().push_back(frame_avg);
+		last.push_back(sample);
 	}
 }
 
-FrameRGB extractRGB(struct input_BGRA_data *BGRA_data)
+void MovingAvg::addSample(uint64_t timestamp, const ColorMean &frame_avg)
 {
-	uint8_t *data = BGRA_data->data;
-	uint32_t width = BGRA_data->width;
-	uint32_t height = BGRA_data->height;
-	uint32_t linesize = BGRA_data->linesize;
-
-	FrameRGB frameRGB(height, vector<vector<uint8_t>>(width));
-
-	for (uint32_t y = 0; y < height; ++y) {
-		for (uint32_t x = 0; x < width; ++x) {
-			uint8_t B = data[y * linesize + x * 4];
-			uint8_t G = data[y * linesize + x * 4 + 1];
-			uint8_t R = data[y * linesize + x * 4 + 2];
+	resamplerInput.assign(frame_avg.begin(), frame_avg.end());
+	size_t count = resampler.push(timestamp, resamplerInput, resampled);
+	for (size_t i = 0; i < count; i++) {
+		updateWindows(resampled[i]);
+	}
+}
 
-			frameRGB[y][x] = {R, G, B};
-		}
+void MovingAvg::setAnalysisRate(double rate)
+{
+	if (rate <= 0.0 || rate == analysisRate) {
+		return;
 	}
 
-	return frameRGB;
+	// Samples already in the windows were taken at the old rate
+	analysisRate = rate;
+	resampler.setRate(rate);
+	clearWindows();
 }
 
-double MovingAvg::welch(vector<double_t> bvps)
+// The Hann window, segment, spectrum and PSD are members sized in the constructor, and the signal is mapped in
+// place, so an estimate does not allocate
+double MovingAvg::welch(const vector<double_t> &bvps)
 {
 	using Eigen::ArrayXd;
 
 	int num_frames = static_cast<int>(bvps.size());
-	int nfft = 2048;
-
-	// Define segment size and overlap
-	int segment_size = 256;
-	int overlap = 200;
+	int segment_size = welchSegmentSize;
+	int overlap = welchOverlap;
 
-	double frequency_resolution = (fps * 60.0) / num_frames;
+	// Bin k of a segment_size point DFT of a signal sampled at analysisRate is at k * analysisRate / segment_size
+	// Hz, whatever the length of the signal the segments are taken from
+	double frequency_resolution = (analysisRate * 60.0) / segment_size;
 	int nyquist_limit = segment_size / 2;
 
-	// Hann window
-	ArrayXd hann_window(segment_size);
-	for (int i = 0; i < segment_size; ++i) {
-		hann_window[i] = 0.5 * (1 - std::cos(2 * M_PI * i / (segment_size - 1)));
-	}
-
-	// Convert signal to Eigen array
-	ArrayXd signal = Eigen::Map<const ArrayXd>(bvps.data(), bvps.size());
+	Eigen::Map<const ArrayXd> signal(bvps.data(), static_cast<Eigen::Index>(bvps.size()));
 
 	// Divide signal into overlapping segments
 	int num_segments = 0;
-	ArrayXd psd = ArrayXd::Zero(nfft / 2 + 1);
+	psd.setZero();
 
 	for (int start = 0; start + segment_size <= num_frames; start += (segment_size - overlap)) {
 		// Extract segment and apply window
-		ArrayXd segment = signal.segment(start, segment_size) * hann_window;
+		segment = signal.segment(start, segment_size) * hannWindow;
 
-		Eigen::ArrayXcd fft_result(segment_size);
+		Eigen::ArrayXcd &fft_result = segmentSpectrum;
 		for (int k = 0; k < segment_size; ++k) {
 			std::complex<double> sum(0.0, 0.0);
 			for (int n = 0; n < segment_size; ++n) {
@@ -138,9 +218,7 @@ double MovingAvg::welch(vector<double_t> bvps)
 			fft_result[k] = sum;
 		}
 
-		// Compute power spectrum
-		ArrayXd power_spectrum =
-			ArrayXd::Zero(nyquist_limit + 1); // Only half the spectrum (0 to Nyquist frequency)
+		// Compute power spectrum, only half the spectrum (0 to Nyquist frequency)
 		for (int k = 0; k <= nyquist_limit; ++k) {
 			psd[k] += std::norm(fft_result[k]) / segment_size;
 		}
@@ -164,17 +242,16 @@ double MovingAvg::welch(vector<double_t> bvps)
 	}
 
 	// Log power spectrum to OBS console in BPM
-	std::ostringstream log_stream;
+	spectrumLog.clear();
 	for (int k = 0; k <= nyquist_limit_bpm; ++k) {
 		if (psd[k] > 0) {
-			double bpm = k * frequency_resolution;
-			log_stream << bpm << " BPM: " << psd[k];
-			if (k < nyquist_limit_bpm) {
-				log_stream << ", ";
-			}
+			char entry[64];
+			snprintf(entry, sizeof(entry), "%g BPM: %g%s", k * frequency_resolution, psd[k],
+				 k < nyquist_limit_bpm ? ", " : "");
+			spectrumLog.append(entry);
 		}
 	}
-	obs_log(LOG_INFO, "%s", log_stream.str().c_str());
+	obs_log(LOG_INFO, "%s", spectrumLog.c_str());
 
 	// Find dominant frequency in BPM
 	int max_index;
@@ -184,17 +261,182 @@ double MovingAvg::welch(vector<double_t> bvps)
 	return dominant_frequency;
 }
 
-Window concatWindows(Windows windows)
+static bool isFullFrame(const struct vec4 &region)
 {
-	Window concatenatedWindow;
+	return region.x <= 0.0f && region.y >= 1.0f && region.z <= 0.0f && region.w >= 1.0f;
+}
 
-	for (const auto &window : windows) {
-		for (const auto &sig : window) {
-			concatenatedWindow.push_back(sig);
-		}
+// Compile the mask for the layout of the frame if it or the layout changed since the last frame
+const CompiledSkinMask &MovingAvg::compileMask(const SkinMask &skinMask, CompiledSkinMask &compiled,
+					       const ImageView &frame)
+{
+	if (compiled.update(skinMask, frame.width, frame.height, frame.stride, frame.bytesPerPixel())) {
+		maskStats.compilations++;
+		maskStats.lastCompileNs = compiled.getCompileTime();
+		maskStats.spanCount = compiled.getSpans().size();
+		maskStats.pixelCount = compiled.count();
+		obs_log(LOG_DEBUG, "Skin mask compiled in %.3f ms: %zu spans, %llu pixels",
+			maskStats.lastCompileNs / 1e6, maskStats.spanCount, (unsigned long long)maskStats.pixelCount);
+	}
+	return compiled;
+}
+
+void MovingAvg::setMinSkinSamples(uint32_t samples)
+{
+	if (samples != minSkinSamples) {
+		// The error measured so far was for another lattice
+		minSkinSamples = samples;
+		subsampleStats = SubsampleStats();
+	}
+}
+
+SampleLattice MovingAvg::nextLattice(uint64_t maskPixels)
+{
+	SampleLattice lattice = jitteredLattice(maskPixels, minSkinSamples, subsampledFrames);
+	subsampleStats.step = lattice.step;
+	return lattice;
+}
+
+void MovingAvg::setThreadCount(size_t threads)
+{
+	pool.resize(threads);
+}
+
+void MovingAvg::setIntegralImage(bool enabled)
+{
+	useIntegralImage = enabled;
+}
+
+void MovingAvg::setDetectionHeight(uint32_t height)
+{
+	detectionHeight = height;
+}
+
+void MovingAvg::setFaceDetector(enum face_detector detector)
+{
+	if (detector < 0 || detector >= FACE_DETECTOR_COUNT) {
+		detector = FACE_DETECTOR_HAAR;
 	}
+	faceDetector = detector;
+}
 
-	return concatenatedWindow;
+void MovingAvg::setFaceTracking(bool enabled)
+{
+	useTracker = enabled;
+	if (!enabled) {
+		tracker.stop();
+	}
+}
+
+void MovingAvg::setSkinMask(const SkinMask &mask)
+{
+	fixedSkinMask = !mask.empty();
+	tracker.stop();
+	latestSkinMask = mask;
+	latestPatchMask = SkinMask();
+	latestMaskRects.clear();
+	latestSkinRegions.clear();
+	detectedSkinRegions.clear();
+	detectFace = fixedSkinMask;
+	detectionPending = false;
+}
+
+bool MovingAvg::getFaceRegion(struct vec4 &face) const
+{
+	if (!detectFace || fixedSkinMask) {
+		return false;
+	}
+
+	face = latestFace;
+	return true;
+}
+
+bool MovingAvg::getSkinRegions(std::vector<struct vec4> &regions) const
+{
+	if (!detectFace || latestSkinRegions.empty()) {
+		return false;
+	}
+
+	regions = latestSkinRegions;
+	return true;
+}
+
+// Factor the grayscale image for the cascades is downscaled by. At a few hundred rows, faces of a typical webcam
+// framing stay well above the 24 pixel window of the frontal face cascade, which then scans far fewer scales. The
+// LBP cascade only finds faces of at least its 45 pixel window, an eighth of the height at 360 rows
+uint32_t MovingAvg::detectionScale(uint32_t height) const
+{
+	return std::max(height / std::max(detectionHeight, 1u), 1u);
+}
+
+// Detection is due every detectionInterval frames, but can only run on a full frame. Samples taken in the meantime
+// from face ROI patches or GPU reductions reuse the previous mask, and the detection runs on the next full frame.
+// Nothing is detected while the mask is fixed by setSkinMask
+void MovingAvg::scheduleDetection()
+{
+	if (fixedSkinMask) {
+		return;
+	}
+	framesSinceFullScan++;
+	int interval = tracker.isTracking() ? trackedDetectionInterval : detectionInterval;
+	if (++framesSinceDetection >= interval) {
+		detectionPending = true;
+	}
+}
+
+static MaskRect toPixels(const struct vec4 &region, uint32_t width, uint32_t height)
+{
+	MaskRect rect;
+	rect.x = static_cast<int32_t>(std::lround(region.x * width));
+	rect.y = static_cast<int32_t>(std::lround(region.z * height));
+	rect.width = static_cast<int32_t>(std::lround(region.y * width)) - rect.x;
+	rect.height = static_cast<int32_t>(std::lround(region.w * height)) - rect.y;
+	return rect;
+}
+
+static bool sameRects(const vector<MaskRect> &a, const vector<MaskRect> &b)
+{
+	auto same = [](const MaskRect &l, const MaskRect &r) {
+		return l.x == r.x && l.y == r.y && l.width == r.width && l.height == r.height;
+	};
+	return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), same);
+}
+
+// Move the regions of the last detection with the face the tracker followed into this frame, returns false when it
+// lost the face
+bool MovingAvg::followFace(const ImageView &frame, std::vector<struct vec4> &face_coordinates, bool &maskChanged)
+{
+	if (!tracker.track(frame, pool)) {
+		obs_log(LOG_DEBUG, "Face tracking lost, detecting again");
+		return false;
+	}
+
+	trackedRegions.clear();
+	trackedRects.clear();
+	for (const struct vec4 &region : detectedSkinRegions) {
+		trackedRegions.push_back(tracker.mapRegion(region, frame.width, frame.height));
+		trackedRects.push_back(toPixels(trackedRegions.back(), frame.width, frame.height));
+	}
+	if (trackedRects.empty() || sameRects(trackedRects, latestMaskRects)) {
+		return true;
+	}
+
+	// The face first, then the eyes and mouth excluded from it, as made by the detection
+	SkinMask skinMask(frame.width, frame.height);
+	skinMask.setInclusion(trackedRects[0]);
+	for (size_t i = 1; i < trackedRects.size(); i++) {
+		skinMask.addExclusion(trackedRects[i]);
+	}
+	latestSkinMask = std::move(skinMask);
+	latestPatchMask = SkinMask();
+	latestMaskRects.swap(trackedRects);
+	maskRectsWidth = frame.width;
+	maskRectsHeight = frame.height;
+	latestSkinRegions = trackedRegions;
+	latestFace = trackedRegions[0];
+	face_coordinates.insert(face_coordinates.end(), trackedRegions.begin(), trackedRegions.end());
+	maskChanged = true;
+	return true;
 }
 
 double MovingAvg::calculateHeartRate(struct input_BGRA_data *BGRA_data, std::vector<struct vec4> &face_coordinates,
@@ -203,29 +445,207 @@ double MovingAvg::calculateHeartRate(struct input_BGRA_data *BGRA_data, std::vec
 	UNUSED_PARAMETER(preFilter);
 	UNUSED_PARAMETER(postFilter);
 
-	FrameRGB frameRGB = extractRGB(BGRA_data);
-	if (windows.empty() || windows.back().size() % 10 == 0 || !detectFace) {
-		vector<vector<bool>> skinKey = detectFacesAndCreateMask(BGRA_data, face_coordinates);
-		vector<double_t> avg = averageRGB(frameRGB, skinKey);
+	uint64_t allocationsBefore = threadAllocationCount();
+	uint64_t compilationsBefore = maskStats.compilations;
+	bool maskChanged = false;
+
+	// The frame is only ever read through this view, it is never copied
+	ImageView frame = makeImageView(BGRA_data);
+
+	// Masked mean colour of the frame. YUV frames are averaged in their own domain without building an RGB copy
+	auto averageFrame = [&](const SkinMask &skinMask, CompiledSkinMask &compiled) {
+		if (useIntegralImage && !isYUVFormat(frame.format)) {
+			return averageRGB(frame, skinMask, compiled);
+		}
+
+		const CompiledSkinMask &spans = compileMask(skinMask, compiled, frame);
+		auto average = [&](const SampleLattice &lattice) {
+			if (isYUVFormat(frame.format)) {
+				return averageYUV(frame, spans, pool, lattice);
+			}
+			return averageRGB(frame, skinMask, spans, lattice);
+		};
+
+		SampleLattice lattice = nextLattice(spans.count());
+		ColorMean sampled = average(lattice);
+		if (lattice.step > 1 && ++subsampledFrames % SUBSAMPLE_AUDIT_INTERVAL == 0) {
+			// Measure what the subsampling costs on this frame
+			ColorMean full = average(SampleLattice());
+			double error = 0.0;
+			for (size_t i = 0; i < full.size(); i++) {
+				error = std::max(error, std::abs(sampled[i] - full[i]));
+			}
+			subsampleStats.audits++;
+			subsampleStats.maxError = std::max(subsampleStats.maxError, error);
+			subsampleStats.meanError += (error - subsampleStats.meanError) / subsampleStats.audits;
+			obs_log(LOG_DEBUG, "Skin mean sampled every %u pixels differs by %.3f from the full mean",
+				lattice.step, error);
+		}
+		return sampled;
+	};
+
+	scheduleDetection();
+
+	// OpenCV allocates in the optical flow, so tracked frames are not held to the allocation check
+	bool tracked = isFullFrame(BGRA_data->region) && detectFace && !detectionPending && tracker.isTracking();
+	if (tracked && !followFace(frame, face_coordinates, maskChanged)) {
+		// Detect on this frame rather than sample it with a mask the face may have left
+		detectionPending = true;
+	}
+
+	if (!isFullFrame(BGRA_data->region)) {
+		// The tracker only follows full frames
+		tracker.stop();
+		if (detectFace) {
+			// Only resample the mask when the patch moves, which happens after each detection
+			if (latestPatchMask.getHeight() != BGRA_data->height ||
+			    latestPatchMask.getWidth() != BGRA_data->width ||
+			    memcmp(&latestPatchRegion, &BGRA_data->region, sizeof(struct vec4)) != 0) {
+				latestPatchMask =
+					latestSkinMask.resample(BGRA_data->region, BGRA_data->width, BGRA_data->height);
+				latestPatchRegion = BGRA_data->region;
+				maskChanged = true;
+			}
+			ColorMean avg = averageFrame(latestPatchMask, compiledPatchMask);
+			addSample(BGRA_data->timestamp, avg);
+		}
+	} else if (detectionPending || !detectFace) {
+		vector<struct vec4> skinRegions;
+		SkinMask skinMask;
+		ColorMean avg;
+		maskChanged = true;
+		uint32_t scale = detectionScale(frame.height);
+		if (frame.width != maskRectsWidth || frame.height != maskRectsHeight) {
+			// The last face is in pixels of frames of another size, so it cannot place a search window
+			latestMaskRects.clear();
+		}
+		bool fullScan = latestMaskRects.empty() || windowMisses >= REDETECTION_MISSES ||
+				framesSinceFullScan >= fullScanInterval;
+		const MaskRect *previousFace = fullScan ? nullptr : &latestMaskRects[0];
+		uint64_t detectionStart = os_gettime_ns();
+		if (!isYUVFormat(frame.format) && !useIntegralImage) {
+			// One pass over the frame sums the skin of the previous mask and makes the downscaled grayscale
+			// image the cascades run on. The sample of this frame is taken with the previous mask, as the
+			// frames before it were, unless there was none
+			const CompiledSkinMask &previous = compileMask(latestSkinMask, compiledFrameMask, frame);
+			ChannelSums sums;
+			sumSpansAndDownscaleGray(frame, previous, scale, pool, sums, detectionGray);
+			skinMask = detectFacesAndCreateMask(detectionGray, scale, frame.width, frame.height,
+							    face_coordinates, skinRegions, previousFace, faceDetector);
+			if (detectFace && previous.count() > 0) {
+				double count = static_cast<double>(previous.count());
+				avg = {sums.r / count, sums.g / count, sums.b / count};
+			} else {
+				avg = averageFrame(skinMask, compiledFrameMask);
+			}
+			if (skinMask.empty()) {
+				avg = {0.0, 0.0, 0.0};
+			}
+		} else {
+			downscaleGray(frame, scale, pool, detectionGray);
+			skinMask = detectFacesAndCreateMask(detectionGray, scale, frame.width, frame.height,
+							    face_coordinates, skinRegions, previousFace, faceDetector);
+			avg = averageFrame(skinMask, compiledFrameMask);
+		}
+		DetectionStats &stats = detectionStats[faceDetector];
+		stats.detections++;
+		stats.lastDetectionNs = os_gettime_ns() - detectionStart;
+		stats.totalDetectionNs += stats.lastDetectionNs;
+		stats.width = static_cast<uint32_t>(detectionGray.cols);
+		stats.height = static_cast<uint32_t>(detectionGray.rows);
+		obs_log(LOG_DEBUG, "%s face detection on %ux%u took %.3f ms, %s", faceDetectorName(faceDetector),
+			stats.width, stats.height, stats.lastDetectionNs / 1e6,
+			fullScan ? "whole image" : "window around the last face");
+		if (fullScan) {
+			stats.fullScans++;
+			framesSinceFullScan = 0;
+			windowMisses = 0;
+		}
+		detectionPending = false;
+		framesSinceDetection = 0;
 		if (avg[0] == 0 && avg[1] == 0 && avg[2] == 0) {
 			detectFace = false;
+			tracker.stop();
+			stats.misses++;
+			if (fullScan) {
+				// Nowhere to search a window around until a face is found again
+				latestMaskRects.clear();
+			} else {
+				windowMisses++;
+			}
 		} else {
+			windowMisses = 0;
 			detectFace = true;
-			latestSkinKey = skinKey;
-			updateWindows(avg);
+			latestSkinMask = std::move(skinMask);
+			// The patch mask was resampled from the previous mask
+			latestPatchMask = SkinMask();
+			latestFace = face_coordinates[0];
+			latestSkinRegions = skinRegions;
+			detectedSkinRegions = skinRegions;
+			latestMaskRects.clear();
+			for (const struct vec4 &region : skinRegions) {
+				latestMaskRects.push_back(toPixels(region, frame.width, frame.height));
+			}
+			maskRectsWidth = frame.width;
+			maskRectsHeight = frame.height;
+			if (useTracker && !latestMaskRects.empty() &&
+			    !tracker.start(frame, latestMaskRects[0], pool)) {
+				obs_log(LOG_DEBUG, "Too few features to track the face");
+			}
+			addSample(BGRA_data->timestamp, avg);
 		}
 	} else {
-		vector<double_t> avg = averageRGB(frameRGB, latestSkinKey);
-		updateWindows(avg);
+		ColorMean avg = averageFrame(latestSkinMask, compiledFrameMask);
+		addSample(BGRA_data->timestamp, avg);
+	}
+
+	double heartRate = estimateHeartRate(ppg);
+	checkAllocations(allocationsBefore, !tracked && !maskChanged && maskStats.compilations == compilationsBefore);
+	return heartRate;
+}
+
+double MovingAvg::calculateHeartRate(const ColorMean &frameAvg, uint64_t timestamp, int ppg)
+{
+	uint64_t allocationsBefore = threadAllocationCount();
+
+	// The tracker only follows full frames
+	tracker.stop();
+	scheduleDetection();
+	addSample(timestamp, frameAvg);
+
+	double heartRate = estimateHeartRate(ppg);
+	checkAllocations(allocationsBefore, true);
+	return heartRate;
+}
+
+// Frames that neither detect or track the face nor change the mask must not allocate once warmed up. Only
+// COUNT_ALLOCATIONS builds count allocations, and they abort on the first frame that breaks this so that it cannot
+// go unnoticed in a log
+void MovingAvg::checkAllocations(uint64_t allocationsBefore, bool steadyState)
+{
+	uint64_t allocations = threadAllocationCount() - allocationsBefore;
+	if (++framesAnalysed > ALLOCATION_WARMUP_FRAMES && steadyState && allocations > 0) {
+		obs_log(LOG_ERROR, "Steady-state analysis of frame %llu made %llu heap allocations",
+			(unsigned long long)framesAnalysed, (unsigned long long)allocations);
+#ifdef COUNT_ALLOCATIONS
+		abort();
+#endif
 	}
+}
 
-	vector<double_t> ppgSignal;
+// The windows are concatenated into a signal buffer reserved for all of them
+double MovingAvg::estimateHeartRate(int ppg)
+{
+	ppgSignal.clear();
 
 	if (!windows.empty() && static_cast<int>(windows.back().size()) == windowSize) {
-		Window currentWindow = concatWindows(windows);
 		switch (ppg) {
 		case 0:
-			ppgSignal = green(currentWindow);
+			// Every window starts with the last windowStride samples of the one before, which are only
+			// taken once so that the signal stays uniformly sampled
+			for (size_t i = 0; i < windows.size(); i++) {
+				appendGreen(windows[i], i == 0 ? 0 : static_cast<size_t>(windowStride), ppgSignal);
+			}
 			break;
 		default:
 			break;
@@ -6,6 +6,7 @@
 #include <vector>
 #include <obs.h>
 #include <Eigen/Dense>
+#include <opencv2/core.hpp>
 #include <vector>
 #include <fstream>
 #include <cmath>
@@ -13,30 +14,235 @@
 #include <algorithm>
 #include <cstdlib>
 #include <ctime>
+#include <string>
 #include "heart_rate_source.h"
+#include "FaceTracker.h"
+#include "FrameStatistics.h"
+#include "ImageView.h"
+#include "IntegralImage.h"
+#include "Resampler.h"
+#include "SkinMask.h"
+#include "ThreadPool.h"
+
+// Statistics of the compiled skin masks of one MovingAvg
+struct MaskStats {
+	uint64_t compilations = 0;
+	// Time the last compilation took, in nanoseconds
+	uint64_t lastCompileNs = 0;
+	size_t spanCount = 0;
+	uint64_t pixelCount = 0;
+};
+
+// Cost of the face detections of one MovingAvg with one detector, grayscale image included
+struct DetectionStats {
+	uint64_t detections = 0;
+	// Time the last detection and all of them took, in nanoseconds
+	uint64_t lastDetectionNs = 0;
+	uint64_t totalDetectionNs = 0;
+	// Size of the grayscale image of the last detection
+	uint32_t width = 0;
+	uint32_t height = 0;
+	// Detections that scanned the whole image rather than a window around the last face, and detections that
+	// found no face
+	uint64_t fullScans = 0;
+	uint64_t misses = 0;
+};
+
+// Windowed re-detections that may miss in a row before the whole frame is scanned again
+#define REDETECTION_MISSES 2
+
+// Measured error of the subsampled skin means, from frames that were also averaged over every skin pixel
+struct SubsampleStats {
+	// Lattice step of the last subsampled frame, 1 when subsampling is off
+	uint32_t step = 1;
+	uint64_t audits = 0;
+	// Largest and mean absolute difference of any channel, in 8-bit levels
+	double maxError = 0.0;
+	double meanError = 0.0;
+};
+
+// Frames analysed before steady-state frames are expected not to allocate, see COUNT_ALLOCATIONS
+#define ALLOCATION_WARMUP_FRAMES 300
+
+// Every this many subsampled frames, the mean over every skin pixel is also taken to measure the error
+#define SUBSAMPLE_AUDIT_INTERVAL 30
 
 class MovingAvg {
 private:
 	int windowSize = 60;
 	int windowStride = 1;
-	int fps = 30;
+	double analysisRate = 30.0;
 	int maxNumWindows = 8;
+	int detectionInterval = 10;
+	// Frames between detections while the tracker follows the face, which then only correct its drift
+	int trackedDetectionInterval = 150;
+
+	// Windows of resampled frame means, consecutive ones sharing windowStride samples. Windows dropped from the
+	// front are kept as spares with their storage and reused for new ones, so that once they are all allocated
+	// adding a sample never allocates
+	std::vector<std::vector<ColorMean>> windows;
+	std::vector<std::vector<ColorMean>> spareWindows;
+
+	std::vector<ColorMean> takeWindow();
+	void clearWindows();
+
+	// Frame averages arrive at their capture timestamps and are resampled to analysisRate before they are added
+	// to the windows, so the spectral estimate sees a uniformly sampled signal
+	UniformResampler resampler;
+	std::vector<double_t> resamplerInput;
+	std::vector<std::vector<double_t>> resampled;
 
-	std::vector<std::vector<std::vector<double_t>>> windows;
+	// Buffers of the spectral estimate, sized once from the window and segment sizes
+	std::vector<double_t> ppgSignal;
+	Eigen::ArrayXd hannWindow;
+	Eigen::ArrayXd segment;
+	Eigen::ArrayXcd segmentSpectrum;
+	Eigen::ArrayXd psd;
+	std::string spectrumLog;
 
-	std::vector<std::vector<bool>> latestSkinKey;
+	// Frames analysed so far, for the allocation check of COUNT_ALLOCATIONS builds
+	uint64_t framesAnalysed = 0;
+
+	SkinMask latestSkinMask;
 	bool detectFace = false;
+	// Set while every frame is sampled with a mask given by setSkinMask rather than a detected one
+	bool fixedSkinMask = false;
+	bool detectionPending = false;
+	int framesSinceDetection = 0;
+
+	// Face rectangle and skin mask rectangles from the latest detection, and the skin mask resampled to the latest
+	// face ROI patch
+	struct vec4 latestFace = {};
+	std::vector<struct vec4> latestSkinRegions;
+	SkinMask latestPatchMask;
+	struct vec4 latestPatchRegion = {};
+
+	// Between detections the tracker follows the face on full frames, and the regions of the last detection are
+	// moved with it. The mask is only rebuilt when one of its rectangles moves by a pixel
+	bool useTracker = true;
+	FaceTracker tracker;
+	std::vector<struct vec4> detectedSkinRegions;
+	std::vector<MaskRect> latestMaskRects;
+	// Size of the frame latestMaskRects are in pixels of, they are dropped when the frames change size
+	uint32_t maskRectsWidth = 0;
+	uint32_t maskRectsHeight = 0;
+	std::vector<struct vec4> trackedRegions;
+	std::vector<MaskRect> trackedRects;
+
+	bool followFace(const ImageView &frame, std::vector<struct vec4> &face_coordinates, bool &maskChanged);
+
+	// The full frame and patch masks compiled for the layout of the frames they are applied to. Both are kept so
+	// that alternating full frames and patches does not recompile either
+	CompiledSkinMask compiledFrameMask;
+	CompiledSkinMask compiledPatchMask;
+	MaskStats maskStats;
+
+	const CompiledSkinMask &compileMask(const SkinMask &skinMask, CompiledSkinMask &compiled,
+					    const ImageView &frame);
+
+	// The per-frame statistics are split into bands of spans summed in parallel, each into its own slot, and the
+	// slots are added in band order
+	ThreadPool pool;
+
+	// Skin means sample a jittered lattice that keeps at least this many pixels, 0 samples every pixel
+	uint32_t minSkinSamples = 0;
+	uint64_t subsampledFrames = 0;
+	SubsampleStats subsampleStats;
+
+	SampleLattice nextLattice(uint64_t maskPixels);
+
+	// Grayscale image made for the cascades by the fused pass over BGRA detection frames, downscaled by a whole
+	// factor to at least detectionHeight rows
+	cv::Mat detectionGray;
+	uint32_t detectionHeight = 360;
+	// One entry per detector, so that detectors can be compared on the same input
+	DetectionStats detectionStats[FACE_DETECTOR_COUNT];
+
+	// Detector the detections run
+	enum face_detector faceDetector = FACE_DETECTOR_HAAR;
 
-	std::vector<double_t> averageRGB(std::vector<std::vector<std::vector<uint8_t>>> rgb,
-					 std::vector<std::vector<bool>> skinKey = {});
+	// Re-detections search a window around the last face, for faces of about its size. The whole frame is scanned
+	// while there is no face, after REDETECTION_MISSES windowed misses in a row, and every fullScanInterval frames
+	// to pick up new subjects
+	int fullScanInterval = 300;
+	int framesSinceFullScan = 0;
+	int windowMisses = 0;
 
-	void updateWindows(std::vector<double_t> frame_avg);
+	uint32_t detectionScale(uint32_t height) const;
 
-	double welch(std::vector<double_t> ppgSignal);
+	// Sum BGRA frames through a summed-area table instead of span by span
+	bool useIntegralImage = false;
+	IntegralImage integralImage;
+
+	ColorMean averageRGB(const ImageView &frame, const SkinMask &skinMask, const CompiledSkinMask &compiled,
+			     const SampleLattice &lattice = SampleLattice());
+
+	void updateWindows(const std::vector<double_t> &frame_avg);
+
+	void addSample(uint64_t timestamp, const ColorMean &frame_avg);
+
+	double welch(const std::vector<double_t> &bvps);
+
+	void scheduleDetection();
+
+	double estimateHeartRate(int ppg);
+
+	void checkAllocations(uint64_t allocationsBefore, bool steadyState);
 
 public:
+	MovingAvg();
+
+	// Rate in Hz of the uniformly resampled signal the heart rate is estimated from, restarts the estimate
+	void setAnalysisRate(double rate);
+
+	// Build an integral image of every BGRA frame and take the skin sums from it, which makes every additional
+	// rectangle region of a frame cost a few lookups
+	void setIntegralImage(bool enabled);
+
+	// Average a lattice of at least this many skin pixels instead of every one, 0 to average every pixel. The
+	// colour error this costs is measured regularly and reported by getSubsampleStats(), its cost in heart rate is
+	// measured offline by the subsample accuracy test. On a moving, textured face about 2000 samples keep the
+	// estimates of a pulse under a level, coarser lattices can drown it
+	void setMinSkinSamples(uint32_t samples);
+
+	SubsampleStats getSubsampleStats() const { return subsampleStats; }
+
+	// Follow the face with the tracker between detections, which are then only needed every
+	// trackedDetectionInterval frames or when the tracker loses the face
+	void setFaceTracking(bool enabled);
+
+	TrackerStats getTrackerStats() const { return tracker.getStats(); }
+
+	// Height in rows the frames are downscaled to, at least, for the face cascades
+	void setDetectionHeight(uint32_t height);
+
+	DetectionStats getDetectionStats(enum face_detector detector) const { return detectionStats[detector]; }
+
+	// Detector the next detections run. Each detector keeps statistics of its own, so switching between them on a
+	// replay compares them
+	void setFaceDetector(enum face_detector detector);
+
+	// Number of threads the per-frame statistics run on, this one included
+	void setThreadCount(size_t threads);
+
+	// Sample every frame with this mask, at the size of the full frames, instead of detecting the face, e.g. for a
+	// region picked by hand or a replay whose face is known. An empty mask goes back to detecting the face
+	void setSkinMask(const SkinMask &mask);
+
+	// Normalised rectangle of the last detected face, returns false while no face is being tracked
+	bool getFaceRegion(struct vec4 &face) const;
+
+	// Rectangles of the last skin mask, the face first and then the rectangles excluded from it
+	bool getSkinRegions(std::vector<struct vec4> &regions) const;
+
+	MaskStats getMaskStats() const { return maskStats; }
+
 	double calculateHeartRate(struct input_BGRA_data *BGRA_data, std::vector<struct vec4> &face_coordinates,
 				  int preFilter = 0, int ppg = 0, int postFilter = 0);
+
+	// Same as above for a frame whose masked mean R, G, B was already computed, e.g. by the GPU reduction. The
+	// timestamp is the capture time of the frame in nanoseconds
+	double calculateHeartRate(const ColorMean &frameAvg, uint64_t timestamp, int ppg = 0);
 };
 
 #endif
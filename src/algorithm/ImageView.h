@@ -0,0 +1,61 @@
+#ifndef IMAGE_VIEW_H
+#define IMAGE_VIEW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <obs.h>
+
+#include "heart_rate_source.h"
+
+// Non-owning view of the planes of a frame: pointer, size, row stride and pixel format. The memory belongs to the
+// frame the view was made from, so views are cheap to create and pass by value but must not outlive it
+struct ImageView {
+	const uint8_t *data = nullptr;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t stride = 0;
+	enum video_format format = VIDEO_FORMAT_BGRA;
+	// Chroma planes of planar YUV formats, NV12 only uses the first
+	const uint8_t *chroma[2] = {nullptr, nullptr};
+	uint32_t chromaStride[2] = {0, 0};
+	// YUV to RGB matrix of YUV frames, as in obs_source_frame
+	const float *colorMatrix = nullptr;
+
+	bool empty() const { return !data || width == 0 || height == 0; }
+
+	// Size in bytes of one pixel of the luma or packed plane
+	uint32_t bytesPerPixel() const
+	{
+		switch (format) {
+		case VIDEO_FORMAT_NV12:
+		case VIDEO_FORMAT_I420:
+			return 1;
+		case VIDEO_FORMAT_YUY2:
+		case VIDEO_FORMAT_UYVY:
+			return 2;
+		default:
+			return 4;
+		}
+	}
+
+	// First byte of row y of the luma or packed plane
+	const uint8_t *row(uint32_t y) const { return data + static_cast<size_t>(y) * stride; }
+};
+
+inline ImageView makeImageView(const struct input_BGRA_data *frame)
+{
+	ImageView view;
+	view.data = frame->data;
+	view.width = frame->width;
+	view.height = frame->height;
+	view.stride = frame->linesize;
+	view.format = frame->format;
+	for (int i = 0; i < 2; i++) {
+		view.chroma[i] = frame->chroma[i];
+		view.chromaStride[i] = frame->chroma_linesize[i];
+	}
+	view.colorMatrix = frame->color_matrix;
+	return view;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include "IntegralImage.h"
+
+#include <algorithm>
+
+void IntegralImage::build(const ImageView &frame, ThreadPool &pool)
+{
+	width = frame.width;
+	height = frame.height;
+	const size_t rowEntries = static_cast<size_t>(width + 1) * 3;
+	table.resize(rowEntries * (height + 1));
+
+	std::fill(table.begin(), table.begin() + rowEntries, 0u);
+
+	// Running sums of each row, bands of rows in parallel
+	size_t rowBands = std::max<size_t>(std::min<size_t>(pool.size(), height), 1);
+	pool.parallelFor(rowBands, [&](size_t band) {
+		uint32_t firstRow = static_cast<uint32_t>(height * band / rowBands);
+		uint32_t lastRow = static_cast<uint32_t>(height * (band + 1) / rowBands);
+		for (uint32_t y = firstRow; y < lastRow; ++y) {
+			const uint8_t *pixel = frame.row(y);
+			uint32_t *out = &table[(y + 1) * rowEntries];
+
+			uint32_t b = 0, g = 0, r = 0;
+			out[0] = out[1] = out[2] = 0;
+			for (uint32_t x = 0; x < width; ++x, pixel += 4) {
+				b += pixel[0];
+				g += pixel[1];
+				r += pixel[2];
+				out[(x + 1) * 3] = b;
+				out[(x + 1) * 3 + 1] = g;
+				out[(x + 1) * 3 + 2] = r;
+			}
+		}
+	});
+
+	// Add each entry to the one below it, top to bottom, bands of columns in parallel. A band walks its slice of
+	// every row in turn, so it streams through the table like the row pass
+	size_t columnBands = std::max<size_t>(std::min<size_t>(pool.size(), rowEntries / 3), 1);
+	pool.parallelFor(columnBands, [&](size_t band) {
+		size_t first = rowEntries / 3 * band / columnBands * 3;
+		size_t last = rowEntries / 3 * (band + 1) / columnBands * 3;
+		for (uint32_t y = 2; y <= height; ++y) {
+			uint32_t *out = &table[y * rowEntries];
+			const uint32_t *above = out - rowEntries;
+			for (size_t i = first; i < last; ++i) {
+				out[i] += above[i];
+			}
+		}
+	});
+}
+
+uint64_t IntegralImage::rectSum(const MaskRect &rect, ChannelSums &sums) const
+{
+	auto clip = [](int64_t value, uint32_t limit) {
+		return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(value, 0), limit));
+	};
+	uint32_t left = clip(rect.x, width);
+	uint32_t right = clip(static_cast<int64_t>(rect.x) + rect.width, width);
+	uint32_t top = clip(rect.y, height);
+	uint32_t bottom = clip(static_cast<int64_t>(rect.y) + rect.height, height);
+	if (left >= right || top >= bottom) {
+		return 0;
+	}
+
+	const uint32_t *a = entry(left, top);
+	const uint32_t *b = entry(right, top);
+	const uint32_t *c = entry(left, bottom);
+	const uint32_t *d = entry(right, bottom);
+	// Unsigned arithmetic wraps, so the result is exact even when the entries themselves have wrapped
+	sums.b += static_cast<uint32_t>(d[0] - b[0] - c[0] + a[0]);
+	sums.g += static_cast<uint32_t>(d[1] - b[1] - c[1] + a[1]);
+	sums.r += static_cast<uint32_t>(d[2] - b[2] - c[2] + a[2]);
+
+	return static_cast<uint64_t>(right - left) * (bottom - top);
+}
+
+uint64_t IntegralImage::maskSum(const SkinMask &mask, ChannelSums &sums)
+{
+	if (mask.getId() != rectsMaskId || width != rectsWidth || height != rectsHeight) {
+		mask.getRects(width, height, rects);
+		rectsMaskId = mask.getId();
+		rectsWidth = width;
+		rectsHeight = height;
+	}
+
+	uint64_t count = 0;
+	for (const MaskRect &rect : rects) {
+		count += rectSum(rect, sums);
+	}
+	return count;
+}
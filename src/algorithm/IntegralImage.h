@@ -0,0 +1,51 @@
+#ifndef INTEGRAL_IMAGE_H
+#define INTEGRAL_IMAGE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "ChannelSums.h"
+#include "ImageView.h"
+#include "SkinMask.h"
+#include "ThreadPool.h"
+
+// Per-channel summed-area table of a BGRA frame. Once built, the B, G, R sums of any rectangle take four lookups,
+// so any number of regions made of rectangles (the face minus its eyes and mouth, a forehead, cheeks, several
+// subjects) can be evaluated per frame at a cost independent of their size
+class IntegralImage {
+private:
+	uint32_t width = 0;
+	uint32_t height = 0;
+	// (width + 1) x (height + 1) entries of B, G, R, with a zero first row and column. The sums are kept modulo
+	// 2^32: they wrap on large frames, but the difference of four entries is still exact as long as the sum of the
+	// rectangle itself fits, which holds for every frame below 16.8 million pixels
+	std::vector<uint32_t> table;
+	// Disjoint rectangles of the last mask summed, for the frame size they were clipped to. They are only worked
+	// out again when the mask or the size changes, so that summing the same mask frame after frame never allocates
+	std::vector<MaskRect> rects;
+	uint64_t rectsMaskId = 0;
+	uint32_t rectsWidth = 0;
+	uint32_t rectsHeight = 0;
+
+	const uint32_t *entry(uint32_t x, uint32_t y) const
+	{
+		return &table[(static_cast<size_t>(y) * (width + 1) + x) * 3];
+	}
+
+public:
+	// Build the table of a BGRA frame: running sums along each row in bands of rows, then down each column in
+	// bands of columns, both in parallel on the pool. The memory is only reallocated when the size grows
+	void build(const ImageView &frame, ThreadPool &pool);
+
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+
+	// Add the sums of a rectangle, clipped to the frame, to sums and return its number of pixels
+	uint64_t rectSum(const MaskRect &rect, ChannelSums &sums) const;
+
+	// Add the sums of the masked pixels to sums and return their number, from a handful of lookups per rectangle
+	// of the mask
+	uint64_t maskSum(const SkinMask &mask, ChannelSums &sums);
+};
+
+#endif
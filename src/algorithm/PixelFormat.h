@@ -0,0 +1,131 @@
+#ifndef PIXEL_FORMAT_H
+#define PIXEL_FORMAT_H
+
+#include <cstdint>
+#include <utility>
+#include <obs.h>
+
+#include "ChannelSums.h"
+#include "ImageView.h"
+
+// Compile-time descriptions of the pixel formats the analysis reads in place. Kernels templated on one of these
+// traits get a loop of their own for each format, with the channel offsets and plane layout as constants, and
+// dispatchPixelFormat picks the instance once per frame rather than per pixel
+
+// BT.601 luma weights in 14-bit fixed point, as used by cv::cvtColor
+#define GRAY_WEIGHT_SHIFT 14
+#define GRAY_WEIGHT_B 1868
+#define GRAY_WEIGHT_G 9617
+#define GRAY_WEIGHT_R 4899
+
+// Packed 4 byte pixels with blue and red at the given byte offsets, green at 1 and the fourth byte ignored
+template<uint32_t BlueOffset, uint32_t RedOffset> struct PackedRGBTraits {
+	static constexpr bool yuv = false;
+	static constexpr uint32_t bytesPerPixel = 4;
+	static constexpr uint32_t blue = BlueOffset;
+	static constexpr uint32_t green = 1;
+	static constexpr uint32_t red = RedOffset;
+
+	// Luma of pixel x of a row, scaled by 2^GRAY_WEIGHT_SHIFT
+	static uint32_t grayFixed(const uint8_t *row, uint32_t x)
+	{
+		const uint8_t *pixel = row + static_cast<size_t>(x) * 4;
+		return pixel[blue] * GRAY_WEIGHT_B + pixel[green] * GRAY_WEIGHT_G + pixel[red] * GRAY_WEIGHT_R;
+	}
+
+	// The span kernels add bytes 0, 1 and 2 to b, g and r, put them back in channel order
+	static void orderSums(ChannelSums &sums)
+	{
+		if (blue != 0) {
+			std::swap(sums.b, sums.r);
+		}
+	}
+};
+
+// BGRX has the layout of BGRA, its fourth byte is ignored like alpha
+using BGRATraits = PackedRGBTraits<0, 2>;
+using RGBATraits = PackedRGBTraits<2, 0>;
+
+// Full resolution Y plane followed by interleaved U, V at half resolution in both directions
+struct NV12Traits {
+	static constexpr bool yuv = true;
+	static constexpr uint32_t bytesPerPixel = 1;
+
+	static uint32_t grayFixed(const uint8_t *row, uint32_t x) { return row[x] << GRAY_WEIGHT_SHIFT; }
+
+	static void sample(const ImageView &frame, uint32_t x, uint32_t y, uint8_t &Y, uint8_t &U, uint8_t &V)
+	{
+		const uint8_t *uv = frame.chroma[0] + (y / 2) * frame.chromaStride[0] + (x / 2) * 2;
+		Y = frame.data[y * frame.stride + x];
+		U = uv[0];
+		V = uv[1];
+	}
+};
+
+// Three planes, U and V at half resolution in both directions
+struct I420Traits {
+	static constexpr bool yuv = true;
+	static constexpr uint32_t bytesPerPixel = 1;
+
+	static uint32_t grayFixed(const uint8_t *row, uint32_t x) { return row[x] << GRAY_WEIGHT_SHIFT; }
+
+	static void sample(const ImageView &frame, uint32_t x, uint32_t y, uint8_t &Y, uint8_t &U, uint8_t &V)
+	{
+		Y = frame.data[y * frame.stride + x];
+		U = frame.chroma[0][(y / 2) * frame.chromaStride[0] + x / 2];
+		V = frame.chroma[1][(y / 2) * frame.chromaStride[1] + x / 2];
+	}
+};
+
+// Packed pairs of pixels sharing their chroma, at half horizontal resolution: Y0 U Y1 V for YUY2 and U Y0 V Y1 for
+// UYVY
+template<uint32_t LumaOffset, uint32_t UOffset, uint32_t VOffset> struct PackedYUVTraits {
+	static constexpr bool yuv = true;
+	static constexpr uint32_t bytesPerPixel = 2;
+
+	static uint32_t grayFixed(const uint8_t *row, uint32_t x)
+	{
+		return row[static_cast<size_t>(x) * 2 + LumaOffset] << GRAY_WEIGHT_SHIFT;
+	}
+
+	static void sample(const ImageView &frame, uint32_t x, uint32_t y, uint8_t &Y, uint8_t &U, uint8_t &V)
+	{
+		const uint8_t *pair = frame.data + y * frame.stride + (x / 2) * 4;
+		Y = pair[(x % 2) * 2 + LumaOffset];
+		U = pair[UOffset];
+		V = pair[VOffset];
+	}
+};
+
+using YUY2Traits = PackedYUVTraits<0, 1, 3>;
+using UYVYTraits = PackedYUVTraits<1, 0, 2>;
+
+// Call visit with the traits of the format, as a value of the traits type, and return whether the format has traits
+template<typename Visitor> bool dispatchPixelFormat(enum video_format format, Visitor &&visit)
+{
+	switch (format) {
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+		visit(BGRATraits());
+		return true;
+	case VIDEO_FORMAT_RGBA:
+		visit(RGBATraits());
+		return true;
+	case VIDEO_FORMAT_NV12:
+		visit(NV12Traits());
+		return true;
+	case VIDEO_FORMAT_I420:
+		visit(I420Traits());
+		return true;
+	case VIDEO_FORMAT_YUY2:
+		visit(YUY2Traits());
+		return true;
+	case VIDEO_FORMAT_UYVY:
+		visit(UYVYTraits());
+		return true;
+	default:
+		return false;
+	}
+}
+
+#endif
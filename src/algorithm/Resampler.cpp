@@ -0,0 +1,80 @@
+#include "Resampler.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void UniformResampler::setRate(double rate)
+{
+	period = 1.0 / rate;
+	reset();
+}
+
+void UniformResampler::reset()
+{
+	started = false;
+}
+
+// Add the integral over [from, to] of the line through (t0, v0) and (t1, v1)
+void UniformResampler::integrate(double from, double to, double t0, double t1, const vector<double_t> &v0,
+				 const vector<double_t> &v1)
+{
+	double span = t1 - t0;
+	double wFrom = (from - t0) / span;
+	double wTo = (to - t0) / span;
+
+	for (size_t i = 0; i < accumulated.size(); i++) {
+		double valueFrom = v0[i] + (v1[i] - v0[i]) * wFrom;
+		double valueTo = v0[i] + (v1[i] - v0[i]) * wTo;
+		accumulated[i] += (to - from) * (valueFrom + valueTo) / 2.0;
+	}
+}
+
+size_t UniformResampler::push(uint64_t timestamp, const vector<double_t> &value, vector<vector<double_t>> &output)
+{
+	bool backwards = started && timestamp < origin;
+	double time = started && !backwards ? static_cast<double>(timestamp - origin) * 1e-9 : 0.0;
+
+	// A sample at the time of the last one, such as the same frame rendered again by a second view of the source,
+	// adds nothing and is dropped
+	if (started && !backwards && time == lastTime && value.size() == lastValue.size()) {
+		return 0;
+	}
+
+	// Start a new output grid on the first sample, when time goes backwards or after a long gap
+	if (!started || backwards || time < lastTime || time - lastTime > maxGap || value.size() != lastValue.size()) {
+		started = true;
+		origin = timestamp;
+		lastTime = 0.0;
+		lastValue = value;
+		binStart = 0.0;
+		accumulated.assign(value.size(), 0.0);
+		return 0;
+	}
+
+	size_t count = 0;
+	double from = lastTime;
+	while (binStart + period <= time) {
+		double binEnd = binStart + period;
+		integrate(from, binEnd, lastTime, time, lastValue, value);
+
+		if (count == output.size()) {
+			output.push_back(accumulated);
+		} else {
+			output[count] = accumulated;
+		}
+		for (double_t &sum : output[count]) {
+			sum /= period;
+		}
+		count++;
+		std::fill(accumulated.begin(), accumulated.end(), 0.0);
+
+		from = binEnd;
+		binStart = binEnd;
+	}
+	integrate(from, time, lastTime, time, lastValue, value);
+
+	lastTime = time;
+	lastValue = value;
+	return count;
+}
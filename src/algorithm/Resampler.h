@@ -0,0 +1,40 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Streaming resampler from irregularly timed samples to a uniform rate. The input is treated as piecewise linear
+// between samples and every output is its mean over one output period, so dropped or jittered frames are
+// interpolated and inputs faster than the output rate are box filtered rather than aliased
+class UniformResampler {
+private:
+	// Longest gap between two inputs that is still interpolated, a longer one restarts the output grid
+	static constexpr double maxGap = 1.0;
+
+	double period = 1.0 / 30.0;
+	bool started = false;
+	uint64_t origin = 0;
+	double lastTime = 0.0;
+	std::vector<double_t> lastValue;
+	double binStart = 0.0;
+	std::vector<double_t> accumulated;
+
+	void integrate(double from, double to, double t0, double t1, const std::vector<double_t> &v0,
+		       const std::vector<double_t> &v1);
+
+public:
+	// Output rate in samples per second, restarts the output grid
+	void setRate(double rate);
+
+	void reset();
+
+	// Add a sample taken at the given time in nanoseconds. Every output period completed by it is written to the
+	// front of output and their number, zero, one or several, is returned. A sample at the time of the previous one
+	// is dropped. Entries of output are overwritten in place, so once it has grown to the most outputs of one push,
+	// pushing no longer allocates
+	size_t push(uint64_t timestamp, const std::vector<double_t> &value, std::vector<std::vector<double_t>> &output);
+};
+
+#endif
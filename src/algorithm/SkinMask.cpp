@@ -0,0 +1,233 @@
+#include "SkinMask.h"
+
+#include <atomic>
+#include <cmath>
+#include <util/platform.h>
+
+uint64_t SkinMask::nextId()
+{
+	static std::atomic<uint64_t> lastId{0};
+	return ++lastId;
+}
+
+SkinMask::SkinMask(uint32_t width, uint32_t height) : width(width), height(height) {}
+
+void SkinMask::setInclusion(const MaskRect &rect)
+{
+	id = nextId();
+	inclusion = rect;
+	hasInclusion = true;
+}
+
+void SkinMask::addExclusion(const MaskRect &rect)
+{
+	id = nextId();
+	auto position = std::upper_bound(exclusions.begin(), exclusions.end(), rect,
+					 [](const MaskRect &a, const MaskRect &b) { return a.x < b.x; });
+	exclusions.insert(position, rect);
+}
+
+void SkinMask::setRowSpans(std::vector<std::vector<MaskSpan>> spans)
+{
+	id = nextId();
+	rowSpans = std::move(spans);
+	rowSpans.resize(height);
+}
+
+bool SkinMask::empty() const
+{
+	return count() == 0;
+}
+
+uint64_t SkinMask::count() const
+{
+	uint64_t total = 0;
+	forEachSpan(width, height, [&](uint32_t, uint32_t begin, uint32_t end) { total += end - begin; });
+	return total;
+}
+
+void SkinMask::getRects(uint32_t frameWidth, uint32_t frameHeight, std::vector<MaskRect> &rects) const
+{
+	rects.clear();
+
+	if (!rowSpans.empty()) {
+		forEachSpan(frameWidth, frameHeight, [&](uint32_t y, uint32_t begin, uint32_t end) {
+			MaskRect rect;
+			rect.x = static_cast<int32_t>(begin);
+			rect.y = static_cast<int32_t>(y);
+			rect.width = static_cast<int32_t>(end - begin);
+			rect.height = 1;
+			rects.push_back(rect);
+		});
+		return;
+	}
+
+	if (!hasInclusion) {
+		return;
+	}
+
+	int32_t left = std::max(inclusion.x, 0);
+	int32_t right = static_cast<int32_t>(
+		std::min<int64_t>(static_cast<int64_t>(inclusion.x) + inclusion.width, std::min(width, frameWidth)));
+	int32_t top = std::max(inclusion.y, 0);
+	int32_t bottom = static_cast<int32_t>(
+		std::min<int64_t>(static_cast<int64_t>(inclusion.y) + inclusion.height, std::min(height, frameHeight)));
+	if (left >= right || top >= bottom) {
+		return;
+	}
+
+	// Split the inclusion along every exclusion edge inside it. Each cell of the resulting grid is either wholly
+	// excluded or wholly kept, and the kept cells of a band are merged into one rectangle per run
+	std::vector<int32_t> xs = {left, right};
+	std::vector<int32_t> ys = {top, bottom};
+	for (const MaskRect &exclusion : exclusions) {
+		xs.push_back(std::min(std::max(exclusion.x, left), right));
+		xs.push_back(std::min(std::max(exclusion.x + exclusion.width, left), right));
+		ys.push_back(std::min(std::max(exclusion.y, top), bottom));
+		ys.push_back(std::min(std::max(exclusion.y + exclusion.height, top), bottom));
+	}
+	std::sort(xs.begin(), xs.end());
+	xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+	std::sort(ys.begin(), ys.end());
+	ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+	auto excluded = [&](int32_t x, int32_t y) {
+		for (const MaskRect &exclusion : exclusions) {
+			if (x >= exclusion.x && x < exclusion.x + exclusion.width && y >= exclusion.y &&
+			    y < exclusion.y + exclusion.height) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	for (size_t j = 0; j + 1 < ys.size(); ++j) {
+		size_t runStart = xs.size();
+		for (size_t i = 0; i + 1 < xs.size(); ++i) {
+			bool kept = !excluded(xs[i], ys[j]);
+			if (kept && runStart == xs.size()) {
+				runStart = i;
+			}
+			bool runEnds = runStart != xs.size() && (!kept || i + 2 == xs.size());
+			if (runEnds) {
+				MaskRect rect;
+				rect.x = xs[runStart];
+				rect.y = ys[j];
+				rect.width = xs[kept ? i + 1 : i] - xs[runStart];
+				rect.height = ys[j + 1] - ys[j];
+				rects.push_back(rect);
+				runStart = xs.size();
+			}
+		}
+	}
+}
+
+// First pixel of a frame of the given size whose centre lies at or after the normalised coordinate
+static int32_t firstPixelFrom(double coordinate, uint32_t size)
+{
+	return static_cast<int32_t>(std::ceil(coordinate * size - 0.5));
+}
+
+SkinMask SkinMask::resample(const struct vec4 &region, uint32_t frameWidth, uint32_t frameHeight) const
+{
+	SkinMask patch(frameWidth, frameHeight);
+	if (width == 0 || height == 0 || region.y <= region.x || region.w <= region.z) {
+		return patch;
+	}
+
+	// Normalised coordinate of the patch of a pixel coordinate of this mask
+	auto patchX = [&](int64_t x) { return (static_cast<double>(x) / width - region.x) / (region.y - region.x); };
+	auto patchY = [&](int64_t y) { return (static_cast<double>(y) / height - region.z) / (region.w - region.z); };
+
+	auto mapRect = [&](const MaskRect &rect) {
+		int32_t left = firstPixelFrom(patchX(rect.x), frameWidth);
+		int32_t right = firstPixelFrom(patchX(static_cast<int64_t>(rect.x) + rect.width), frameWidth);
+		int32_t top = firstPixelFrom(patchY(rect.y), frameHeight);
+		int32_t bottom = firstPixelFrom(patchY(static_cast<int64_t>(rect.y) + rect.height), frameHeight);
+
+		MaskRect mapped;
+		mapped.x = left;
+		mapped.y = top;
+		mapped.width = std::max(right - left, 0);
+		mapped.height = std::max(bottom - top, 0);
+		return mapped;
+	};
+
+	if (rowSpans.empty()) {
+		if (hasInclusion) {
+			patch.setInclusion(mapRect(inclusion));
+		}
+		for (const MaskRect &exclusion : exclusions) {
+			patch.addExclusion(mapRect(exclusion));
+		}
+		return patch;
+	}
+
+	// Each patch row takes the spans of the mask row under its centre
+	std::vector<std::vector<MaskSpan>> spans(frameHeight);
+	for (uint32_t y = 0; y < frameHeight; ++y) {
+		double v = region.z + (y + 0.5) / frameHeight * (region.w - region.z);
+		uint32_t maskY = std::min(static_cast<uint32_t>(v * height), height - 1);
+		for (const MaskSpan &span : rowSpans[maskY]) {
+			int32_t begin = std::max(firstPixelFrom(patchX(span.begin), frameWidth), 0);
+			int32_t end = std::min(firstPixelFrom(patchX(span.end), frameWidth),
+					       static_cast<int32_t>(frameWidth));
+			if (begin < end) {
+				spans[y].push_back({static_cast<uint32_t>(begin), static_cast<uint32_t>(end)});
+			}
+		}
+	}
+	patch.setRowSpans(std::move(spans));
+	return patch;
+}
+
+bool CompiledSkinMask::update(const SkinMask &mask, uint32_t frameWidth, uint32_t frameHeight, uint32_t frameStride,
+			      uint32_t frameBytesPerPixel)
+{
+	if (compiled && maskId == mask.getId() && width == frameWidth && height == frameHeight &&
+	    stride == frameStride && bytesPerPixel == frameBytesPerPixel) {
+		return false;
+	}
+
+	uint64_t start = os_gettime_ns();
+
+	spans.clear();
+	pixelCount = 0;
+	mask.forEachSpan(frameWidth, frameHeight, [&](uint32_t y, uint32_t begin, uint32_t end) {
+		CompiledSpan span;
+		span.offset = static_cast<size_t>(y) * frameStride + static_cast<size_t>(begin) * frameBytesPerPixel;
+		span.y = y;
+		span.x = begin;
+		span.length = end - begin;
+		spans.push_back(span);
+		pixelCount += span.length;
+	});
+
+	maskId = mask.getId();
+	width = frameWidth;
+	height = frameHeight;
+	stride = frameStride;
+	bytesPerPixel = frameBytesPerPixel;
+	compiled = true;
+	compileNs = os_gettime_ns() - start;
+	return true;
+}
+
+size_t CompiledSkinMask::splitBands(size_t maxBands, size_t *bounds) const
+{
+	uint64_t bands = std::min<uint64_t>(maxBands, pixelCount / MIN_BAND_PIXELS);
+	bands = std::max<uint64_t>(bands, 1);
+
+	size_t closed = 1;
+	bounds[0] = 0;
+	uint64_t pixels = 0;
+	for (size_t i = 0; i < spans.size() && closed < bands; i++) {
+		pixels += spans[i].length;
+		// Close the band once it holds its share of the pixels
+		if (pixels * bands >= pixelCount * closed) {
+			bounds[closed++] = i + 1;
+		}
+	}
+	bounds[closed] = spans.size();
+	return closed;
+}
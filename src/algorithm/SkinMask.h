@@ -0,0 +1,176 @@
+#ifndef SKIN_MASK_H
+#define SKIN_MASK_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <obs.h>
+
+// Pixel rectangle of a mask, in the coordinates of the frame the mask was built on
+struct MaskRect {
+	int32_t x = 0;
+	int32_t y = 0;
+	int32_t width = 0;
+	int32_t height = 0;
+};
+
+// Half-open run [begin, end) of masked pixels on one row
+struct MaskSpan {
+	uint32_t begin;
+	uint32_t end;
+};
+
+// Skin mask stored as an inclusion rectangle minus exclusion rectangles, or as explicit per-row spans for masks of
+// any other shape. It takes O(regions) memory instead of a bit per pixel, and is read as contiguous row spans so
+// that the averaging loops sum whole runs without testing every pixel
+class SkinMask {
+private:
+	// Identifies the content of the mask: copies share it, and every change assigns a new one
+	uint64_t id = nextId();
+	uint32_t width = 0;
+	uint32_t height = 0;
+	bool hasInclusion = false;
+	MaskRect inclusion;
+	// Sorted by x, so that the spans of a row come out in order
+	std::vector<MaskRect> exclusions;
+	// Used instead of the rectangles when not empty, one list of sorted, disjoint spans per row
+	std::vector<std::vector<MaskSpan>> rowSpans;
+
+	static uint64_t nextId();
+
+public:
+	SkinMask() = default;
+
+	// An empty mask over a frame of the given size
+	SkinMask(uint32_t width, uint32_t height);
+
+	void setInclusion(const MaskRect &rect);
+	void addExclusion(const MaskRect &rect);
+
+	// Replace the rectangles by explicit spans, one list per row of the mask
+	void setRowSpans(std::vector<std::vector<MaskSpan>> spans);
+
+	uint64_t getId() const { return id; }
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+
+	// Whether no pixel is masked
+	bool empty() const;
+
+	// Number of masked pixels
+	uint64_t count() const;
+
+	// Decompose the mask, clipped to a frame of the given size, into disjoint rectangles. Overlapping exclusions
+	// are handled, and explicit row spans become one rectangle each
+	void getRects(uint32_t frameWidth, uint32_t frameHeight, std::vector<MaskRect> &rects) const;
+
+	// Map the mask onto a frame of the given size that covers the normalised region (min x, max x, min y, max y)
+	// of the frame the mask was built on. A pixel of that frame is masked when its centre is
+	SkinMask resample(const struct vec4 &region, uint32_t frameWidth, uint32_t frameHeight) const;
+
+	// Call visit(y, begin, end) for every span of masked pixels, row by row and left to right, clipped to a
+	// frame of the given size
+	template<typename Visitor> void forEachSpan(uint32_t frameWidth, uint32_t frameHeight, Visitor visit) const
+	{
+		uint32_t rows = std::min(height, frameHeight);
+		uint32_t columns = std::min(width, frameWidth);
+
+		if (!rowSpans.empty()) {
+			for (uint32_t y = 0; y < rows; ++y) {
+				for (const MaskSpan &span : rowSpans[y]) {
+					uint32_t end = std::min(span.end, columns);
+					if (span.begin < end) {
+						visit(y, span.begin, end);
+					}
+				}
+			}
+			return;
+		}
+
+		if (!hasInclusion) {
+			return;
+		}
+
+		auto clip = [](int64_t value, uint32_t limit) {
+			return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(value, 0), limit));
+		};
+		uint32_t top = clip(inclusion.y, rows);
+		uint32_t bottom = clip(static_cast<int64_t>(inclusion.y) + inclusion.height, rows);
+		uint32_t left = clip(inclusion.x, columns);
+		uint32_t right = clip(static_cast<int64_t>(inclusion.x) + inclusion.width, columns);
+
+		for (uint32_t y = top; y < bottom; ++y) {
+			// Subtract the exclusions covering this row from the inclusion, in x order
+			uint32_t cursor = left;
+			for (const MaskRect &exclusion : exclusions) {
+				int64_t row = y;
+				if (row < exclusion.y || row >= exclusion.y + exclusion.height) {
+					continue;
+				}
+				int64_t exclusionLeft = exclusion.x;
+				int64_t exclusionRight = static_cast<int64_t>(exclusion.x) + exclusion.width;
+				if (exclusionLeft > cursor) {
+					uint32_t end = clip(exclusionLeft, right);
+					if (cursor < end) {
+						visit(y, cursor, end);
+					}
+				}
+				if (exclusionRight > cursor) {
+					cursor = clip(exclusionRight, right);
+				}
+			}
+			if (cursor < right) {
+				visit(y, cursor, right);
+			}
+		}
+	}
+};
+
+// Fewest masked pixels worth handing to a thread of their own
+#define MIN_BAND_PIXELS 32768
+
+// Masked span of one row, with the byte offset of its first pixel from the start of the frame
+struct CompiledSpan {
+	size_t offset;
+	uint32_t y;
+	uint32_t x;
+	uint32_t length;
+};
+
+// Skin mask compiled for a given frame layout into the list of its spans, so that the per-frame pass walks the
+// skin pixels in memory order without working out the spans again. It is only recompiled when the mask or the
+// layout changes
+class CompiledSkinMask {
+private:
+	uint64_t maskId = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t stride = 0;
+	uint32_t bytesPerPixel = 0;
+	bool compiled = false;
+
+	std::vector<CompiledSpan> spans;
+	uint64_t pixelCount = 0;
+	uint64_t compileNs = 0;
+
+public:
+	// Compile the mask for a frame of the given size, row stride and pixel size unless it already is. Returns
+	// whether it was compiled
+	bool update(const SkinMask &mask, uint32_t frameWidth, uint32_t frameHeight, uint32_t frameStride,
+		    uint32_t frameBytesPerPixel);
+
+	const std::vector<CompiledSpan> &getSpans() const { return spans; }
+
+	// Number of masked pixels
+	uint64_t count() const { return pixelCount; }
+
+	// Split the spans into at most maxBands runs of consecutive spans with about the same number of pixels and at
+	// least MIN_BAND_PIXELS each. Band i covers spans [bounds[i], bounds[i + 1]), bounds holds maxBands + 1 entries
+	// and the number of bands is returned
+	size_t splitBands(size_t maxBands, size_t *bounds) const;
+
+	// Time the last compilation took, in nanoseconds
+	uint64_t getCompileTime() const { return compileNs; }
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t size)
+{
+	resize(size);
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+void ThreadPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+	stopping = false;
+}
+
+void ThreadPool::resize(size_t size)
+{
+	size = std::min(std::max(size, static_cast<size_t>(1)), static_cast<size_t>(MAX_ANALYSIS_THREADS));
+	if (size == this->size()) {
+		return;
+	}
+
+	stop();
+	for (size_t i = 1; i < size; i++) {
+		threads.emplace_back(&ThreadPool::run, this);
+	}
+}
+
+void ThreadPool::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		wake.wait(lock, [this] { return stopping || nextTask < taskCount; });
+		if (stopping) {
+			return;
+		}
+
+		size_t index = nextTask++;
+		TaskCaller call = caller;
+		const void *current = task;
+		lock.unlock();
+		call(current, index);
+		lock.lock();
+
+		if (--pending == 0) {
+			done.notify_all();
+		}
+	}
+}
+
+void ThreadPool::runPass(size_t count, TaskCaller call, const void *fn)
+{
+	if (threads.empty() || count <= 1) {
+		for (size_t i = 0; i < count; i++) {
+			call(fn, i);
+		}
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	caller = call;
+	task = fn;
+	taskCount = count;
+	nextTask = 0;
+	pending = count;
+	wake.notify_all();
+
+	// Work on the pass as well rather than wait for it
+	while (nextTask < taskCount) {
+		size_t index = nextTask++;
+		lock.unlock();
+		call(fn, index);
+		lock.lock();
+		pending--;
+	}
+	done.wait(lock, [this] { return pending == 0; });
+
+	caller = nullptr;
+	task = nullptr;
+	taskCount = 0;
+	nextTask = 0;
+}
+
+size_t defaultAnalysisThreadCount()
+{
+	size_t cores = std::thread::hardware_concurrency();
+	return std::min(std::max(cores / 4, static_cast<size_t>(1)), static_cast<size_t>(4));
+}
@@ -0,0 +1,65 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Most threads the frame statistics of one filter are split across
+#define MAX_ANALYSIS_THREADS 16
+
+// Small persistent pool that runs the bands of a data-parallel pass. The calling thread takes part in every pass,
+// so a pool of size n keeps n - 1 threads of its own
+class ThreadPool {
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool stopping = false;
+
+	// Calls task i of a pass through the type-erased task of parallelFor
+	typedef void (*TaskCaller)(const void *task, size_t index);
+
+	template<typename Task> static void callTask(const void *task, size_t index)
+	{
+		(*static_cast<const Task *>(task))(index);
+	}
+
+	// The pass being run: tasks [nextTask, taskCount) are yet to be claimed, pending ones are not finished
+	TaskCaller caller = nullptr;
+	const void *task = nullptr;
+	size_t taskCount = 0;
+	size_t nextTask = 0;
+	size_t pending = 0;
+
+	void run();
+	void stop();
+	void runPass(size_t count, TaskCaller call, const void *fn);
+
+public:
+	explicit ThreadPool(size_t size = 1);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	// Number of threads a pass runs on, the calling one included
+	size_t size() const { return threads.size() + 1; }
+
+	// Restart the pool with the given number of threads, the calling one included
+	void resize(size_t size);
+
+	// Run task(i) for every i in [0, count) and return once all of them are done. Tasks are claimed in order but
+	// finish in any order, so each must write its own result for the caller to combine in task order. The task is
+	// called through a plain function pointer rather than wrapped in a std::function, so a pass never allocates
+	template<typename Task> void parallelFor(size_t count, const Task &fn) { runPass(count, &callTask<Task>, &fn); }
+};
+
+// Default number of analysis threads: a quarter of the cores, at most 4, so that OBS keeps most of the CPU for its
+// own rendering and encoder threads
+size_t defaultAnalysisThreadCount();
+
+#endif
@@ -0,0 +1,198 @@
+#include "analysis_worker.h"
+#include "algorithm/FaceDetection.h"
+
+#include <obs-module.h>
+#include <exception>
+#include "plugin-support.h"
+
+AnalysisWorker::AnalysisWorker() : thread(&AnalysisWorker::run, this) {}
+
+AnalysisWorker::~AnalysisWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		stopping = true;
+	}
+	wakeup.notify_one();
+	thread.join();
+
+	obs_log(LOG_INFO, "Captured frames: %llu published, %llu analysed, %llu overwritten before analysis",
+		(unsigned long long)framesPublished(),
+		(unsigned long long)(renderedFrames.framesConsumed() + asyncFrames.framesConsumed()),
+		(unsigned long long)framesOverwritten());
+
+	MaskStats stats = avg.getMaskStats();
+	obs_log(LOG_INFO, "Skin mask compiled %llu times, last in %.3f ms: %zu spans, %llu pixels",
+		(unsigned long long)stats.compilations, stats.lastCompileNs / 1e6, stats.spanCount,
+		(unsigned long long)stats.pixelCount);
+
+	SubsampleStats subsample = avg.getSubsampleStats();
+	if (subsample.audits > 0) {
+		obs_log(LOG_INFO, "Skin means sampled every %u pixels: error %.3f on average, %.3f at most",
+			subsample.step, subsample.meanError, subsample.maxError);
+	}
+
+	// One line per detector that ran, side by side when the detector was switched during the session
+	for (int i = 0; i < FACE_DETECTOR_COUNT; i++) {
+		enum face_detector detector = static_cast<enum face_detector>(i);
+		DetectionStats detection = avg.getDetectionStats(detector);
+		if (detection.detections == 0) {
+			continue;
+		}
+		obs_log(LOG_INFO,
+			"%s face detection ran %llu times, %.3f ms each, last on %ux%u, %llu whole image, %llu missed",
+			faceDetectorName(detector), (unsigned long long)detection.detections,
+			detection.totalDetectionNs / 1e6 / detection.detections, detection.width, detection.height,
+			(unsigned long long)detection.fullScans, (unsigned long long)detection.misses);
+	}
+
+	TrackerStats tracking = avg.getTrackerStats();
+	if (tracking.trackedFrames > 0) {
+		obs_log(LOG_INFO, "Face tracked on %llu frames in %.3f ms each, lost %llu times",
+			(unsigned long long)tracking.trackedFrames,
+			tracking.totalTrackNs / 1e6 / (tracking.trackedFrames + tracking.losses),
+			(unsigned long long)tracking.losses);
+	}
+}
+
+void AnalysisWorker::publish(TripleBuffer<captured_frame> &frames, struct captured_frame &&frame)
+{
+	frames.writeBuffer() = std::move(frame);
+	frames.publish();
+	// The buffer taken back may still hold a frame the analysis never took, return it to the pool now
+	frames.writeBuffer() = captured_frame();
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		framesPending = true;
+	}
+	wakeup.notify_one();
+}
+
+void AnalysisWorker::submitRendered(struct captured_frame &&frame)
+{
+	publish(renderedFrames, std::move(frame));
+}
+
+void AnalysisWorker::submitAsync(struct captured_frame &&frame)
+{
+	publish(asyncFrames, std::move(frame));
+}
+
+void AnalysisWorker::configure(const AnalysisSettings &settings)
+{
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		pendingSettings = settings;
+		settingsChanged = true;
+	}
+	wakeup.notify_one();
+}
+
+void AnalysisWorker::takeResults(double &heart_rate, std::vector<struct vec4> &face_coordinates)
+{
+	std::lock_guard<std::mutex> lock(resultsMutex);
+	heart_rate = heartRate;
+	heartRate = 0.0;
+	face_coordinates.clear();
+	face_coordinates.swap(faceCoordinates);
+}
+
+bool AnalysisWorker::getFaceRegion(struct vec4 &face)
+{
+	std::lock_guard<std::mutex> lock(resultsMutex);
+	face = faceRegion;
+	return hasFaceRegion;
+}
+
+bool AnalysisWorker::getSkinRegions(std::vector<struct vec4> &regions)
+{
+	std::lock_guard<std::mutex> lock(resultsMutex);
+	regions = skinRegions;
+	return !regions.empty();
+}
+
+uint64_t AnalysisWorker::framesPublished() const
+{
+	return renderedFrames.framesPublished() + asyncFrames.framesPublished();
+}
+
+uint64_t AnalysisWorker::framesOverwritten() const
+{
+	return renderedFrames.framesOverwritten() + asyncFrames.framesOverwritten();
+}
+
+void AnalysisWorker::run()
+{
+	for (;;) {
+		AnalysisSettings settings;
+		bool reconfigure;
+		{
+			std::unique_lock<std::mutex> lock(stateMutex);
+			wakeup.wait(lock, [this] { return stopping || settingsChanged || framesPending; });
+			if (stopping) {
+				return;
+			}
+			// Frames published from here on set it again, so none is left waiting for the next wake-up
+			framesPending = false;
+
+			reconfigure = settingsChanged;
+			settingsChanged = false;
+			if (reconfigure) {
+				settings = pendingSettings;
+			}
+		}
+
+		if (reconfigure) {
+			avg.setAnalysisRate(settings.analysisRate);
+			avg.setIntegralImage(settings.integralImage);
+			avg.setThreadCount(settings.threadCount);
+			avg.setMinSkinSamples(settings.minSkinSamples);
+			avg.setFaceTracking(settings.faceTracking);
+			avg.setDetectionHeight(settings.detectionHeight);
+			avg.setFaceDetector(settings.faceDetector);
+		}
+
+		for (TripleBuffer<captured_frame> *frames : {&renderedFrames, &asyncFrames}) {
+			if (frames->update()) {
+				// Move the frame out, so that its buffer returns to the pool as soon as it is analysed
+				struct captured_frame frame = std::move(frames->readBuffer());
+				analyse(frame);
+			}
+		}
+	}
+}
+
+void AnalysisWorker::analyse(struct captured_frame &frame)
+{
+	frameFaceCoordinates.clear();
+	double heart_rate = 0.0;
+	try {
+		if (frame.has_means) {
+			ColorMean frame_avg = {frame.means[0], frame.means[1], frame.means[2]};
+			heart_rate = avg.calculateHeartRate(frame_avg, frame.timestamp);
+		} else {
+			heart_rate = avg.calculateHeartRate(frame.BGRA_data.get(), frameFaceCoordinates);
+		}
+	} catch (const std::exception &e) {
+		// An exception must not escape the thread, skip the frame instead
+		obs_log(LOG_INFO, "Frame analysis failed: %s", e.what());
+		return;
+	}
+
+	struct vec4 face;
+	bool has_face = avg.getFaceRegion(face);
+	if (!avg.getSkinRegions(frameSkinRegions)) {
+		frameSkinRegions.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(resultsMutex);
+	hasFaceRegion = has_face;
+	faceRegion = face;
+	skinRegions.swap(frameSkinRegions);
+	if (heart_rate != 0.0) {
+		heartRate = heart_rate;
+	}
+	if (!frameFaceCoordinates.empty()) {
+		faceCoordinates.swap(frameFaceCoordinates);
+	}
+}
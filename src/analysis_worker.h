@@ -0,0 +1,103 @@
+#ifndef ANALYSIS_WORKER_H
+#define ANALYSIS_WORKER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "heart_rate_source.h"
+#include "triple_buffer.h"
+#include "algorithm/HeartRateAlgorithm.h"
+
+// Settings of the analysis, handed to the worker which applies them between two frames
+struct AnalysisSettings {
+	// Rate in Hz of the uniformly resampled signal, see MovingAvg::setAnalysisRate
+	double analysisRate = 30.0;
+	// See MovingAvg::setIntegralImage
+	bool integralImage = false;
+	// See MovingAvg::setThreadCount
+	size_t threadCount = 1;
+	// See MovingAvg::setMinSkinSamples
+	uint32_t minSkinSamples = 0;
+	// See MovingAvg::setFaceTracking
+	bool faceTracking = true;
+	// See MovingAvg::setDetectionHeight
+	uint32_t detectionHeight = 360;
+	// See MovingAvg::setFaceDetector
+	enum face_detector faceDetector = FACE_DETECTOR_HAAR;
+};
+
+// Runs the whole heart rate pipeline of one filter, face detection included, on its own thread. Frames are
+// submitted by the render callback or by filter_video through wait-free triple buffers, and both only pick up the
+// latest results, so they never wait for the analysis nor take a lock the analysis holds for long. The worker sleeps
+// until a frame or new settings arrive
+class AnalysisWorker {
+private:
+	MovingAvg avg;
+
+	// Frames of the render callback and of filter_video, each the only producer of its buffer. The worker
+	// analyses the newest frame, frames published while it was busy are overwritten
+	TripleBuffer<captured_frame> renderedFrames;
+	TripleBuffer<captured_frame> asyncFrames;
+
+	std::mutex stateMutex;
+	std::condition_variable wakeup;
+	bool stopping = false;
+	// Set under stateMutex after a frame is published, so that the worker cannot miss the wake-up between its
+	// check and its wait
+	bool framesPending = false;
+	AnalysisSettings pendingSettings;
+	bool settingsChanged = false;
+
+	std::mutex resultsMutex;
+	double heartRate = 0.0;
+	std::vector<struct vec4> faceCoordinates;
+	// Copies of the tracking state of avg for the render callback, which picks what to read back from them
+	bool hasFaceRegion = false;
+	struct vec4 faceRegion = {};
+	std::vector<struct vec4> skinRegions;
+
+	// Results of the frame being analysed, only touched by the worker thread. They are swapped with the published
+	// ones, so the buffers of both are reused from frame to frame
+	std::vector<struct vec4> frameFaceCoordinates;
+	std::vector<struct vec4> frameSkinRegions;
+
+	// Declared last so that the thread starts once every other member is constructed
+	std::thread thread;
+
+	void run();
+
+	void publish(TripleBuffer<captured_frame> &frames, struct captured_frame &&frame);
+
+	void analyse(struct captured_frame &frame);
+
+public:
+	AnalysisWorker();
+	~AnalysisWorker();
+
+	AnalysisWorker(const AnalysisWorker &) = delete;
+	AnalysisWorker &operator=(const AnalysisWorker &) = delete;
+
+	// Hand a frame captured by the render callback, or by filter_video, to the analysis without blocking. Each
+	// must only be called from its own thread
+	void submitRendered(struct captured_frame &&frame);
+	void submitAsync(struct captured_frame &&frame);
+
+	void configure(const AnalysisSettings &settings);
+
+	// Hand over the results published since the last call. heart_rate is left at 0 and face_coordinates empty
+	// when there is nothing new
+	void takeResults(double &heart_rate, std::vector<struct vec4> &face_coordinates);
+
+	// Same as MovingAvg::getFaceRegion and MovingAvg::getSkinRegions, as of the last analysed frame
+	bool getFaceRegion(struct vec4 &face);
+	bool getSkinRegions(std::vector<struct vec4> &regions);
+
+	// Frames handed over, and those overwritten before the analysis took them
+	uint64_t framesPublished() const;
+	uint64_t framesOverwritten() const;
+};
+
+#endif
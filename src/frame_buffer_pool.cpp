@@ -0,0 +1,106 @@
+#include "frame_buffer_pool.h"
+#include "heart_rate_source.h"
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+struct FrameBuffer {
+	std::unique_ptr<uint8_t[]> storage;
+	size_t capacity = 0;
+	bool inUse = false;
+	struct input_BGRA_data frame = {};
+};
+
+struct FrameBufferPool::State {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+};
+
+// Round a row pitch up so that every row starts on its own cache line
+static uint32_t alignedLinesize(uint32_t width)
+{
+	uint32_t linesize = width * 4;
+	return (linesize + FRAME_BUFFER_ALIGNMENT - 1) & ~static_cast<uint32_t>(FRAME_BUFFER_ALIGNMENT - 1);
+}
+
+// Reset the buffer to an empty BGRA frame, (re)allocating its memory if the frame size changed since it was last used
+static void resizeBuffer(FrameBuffer &buffer, uint32_t width, uint32_t height)
+{
+	struct input_BGRA_data &frame = buffer.frame;
+	// The previous user may have stored YUV planes in the buffer
+	frame.format = VIDEO_FORMAT_BGRA;
+	frame.chroma[0] = frame.chroma[1] = nullptr;
+	if (buffer.storage && frame.width == width && frame.height == height) {
+		frame.linesize = alignedLinesize(width);
+		return;
+	}
+
+	uint32_t linesize = alignedLinesize(width);
+	size_t size = static_cast<size_t>(linesize) * height;
+	if (size > buffer.capacity) {
+		// Over-allocate by one cache line so the start of the data can be aligned
+		buffer.storage.reset(new uint8_t[size + FRAME_BUFFER_ALIGNMENT]);
+		buffer.capacity = size;
+	}
+
+	uintptr_t base = reinterpret_cast<uintptr_t>(buffer.storage.get());
+	uintptr_t aligned = (base + FRAME_BUFFER_ALIGNMENT - 1) & ~static_cast<uintptr_t>(FRAME_BUFFER_ALIGNMENT - 1);
+
+	frame.data = reinterpret_cast<uint8_t *>(aligned);
+	frame.width = width;
+	frame.height = height;
+	frame.linesize = linesize;
+}
+
+FrameBufferPool::FrameBufferPool(size_t capacity) : state(std::make_shared<State>())
+{
+	for (size_t i = 0; i < capacity; i++) {
+		state->buffers.push_back(std::make_unique<FrameBuffer>());
+	}
+}
+
+std::shared_ptr<input_BGRA_data> FrameBufferPool::acquire(uint32_t width, uint32_t height)
+{
+	std::lock_guard<std::mutex> lock(state->mutex);
+
+	for (auto &buffer : state->buffers) {
+		if (buffer->inUse) {
+			continue;
+		}
+
+		resizeBuffer(*buffer, width, height);
+		buffer->inUse = true;
+
+		// The deleter keeps the pool state alive, so frames may outlive the pool that handed them out
+		std::shared_ptr<State> owner = state;
+		FrameBuffer *released = buffer.get();
+		return std::shared_ptr<input_BGRA_data>(&buffer->frame, [owner, released](input_BGRA_data *) {
+			std::lock_guard<std::mutex> releaseLock(owner->mutex);
+			released->inUse = false;
+		});
+	}
+
+	return nullptr;
+}
+
+std::shared_ptr<input_BGRA_data> FrameBufferPool::copyFrom(const uint8_t *data, uint32_t linesize, uint32_t width,
+							   uint32_t height)
+{
+	std::shared_ptr<input_BGRA_data> frame = acquire(width, height);
+	if (!frame) {
+		return nullptr;
+	}
+
+	size_t rowSize = static_cast<size_t>(width) * 4;
+	if (linesize == frame->linesize) {
+		memcpy(frame->data, data, static_cast<size_t>(linesize) * height);
+	} else {
+		for (uint32_t y = 0; y < height; ++y) {
+			memcpy(frame->data + static_cast<size_t>(y) * frame->linesize,
+			       data + static_cast<size_t>(y) * linesize, rowSize);
+		}
+	}
+
+	return frame;
+}
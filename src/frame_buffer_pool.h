@@ -0,0 +1,34 @@
+#ifndef FRAME_BUFFER_POOL_H
+#define FRAME_BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Alignment of every frame buffer and of every row inside it, one cache line
+#define FRAME_BUFFER_ALIGNMENT 64
+// Number of frames that can be referenced at the same time: one being captured, one published in each of the
+// analysis worker's triple buffers, the frame being analysed and spares
+#define FRAME_BUFFER_POOL_SIZE 6
+
+struct input_BGRA_data;
+
+// Fixed pool of reference-counted BGRA frame buffers. A frame handed out by acquire() returns to the pool when
+// its last std::shared_ptr is released, and its memory is only reallocated when the requested size changes
+class FrameBufferPool {
+public:
+	explicit FrameBufferPool(size_t capacity = FRAME_BUFFER_POOL_SIZE);
+
+	// Returns a frame with an owned buffer of the given size, or nullptr if every buffer is still in use
+	std::shared_ptr<input_BGRA_data> acquire(uint32_t width, uint32_t height);
+
+	// Copies a BGRA image with the given row pitch into a pooled frame, or returns nullptr if the pool is exhausted
+	std::shared_ptr<input_BGRA_data> copyFrom(const uint8_t *data, uint32_t linesize, uint32_t width,
+						  uint32_t height);
+
+private:
+	struct State;
+	std::shared_ptr<State> state;
+};
+
+#endif
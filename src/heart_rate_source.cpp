@@ -1,4 +1,5 @@
-#include "algorithm/HeartRateAlgorithm.h"
+#include "algorithm/FrameConversion.h"
+#include "analysis_worker.h"
 
 #include <obs-module.h>
 #include <obs.h>
@@ -13,8 +14,6 @@
 #include "plugin-support.h"
 #include "heart_rate_source.h"
 
-MovingAvg avg;
-
 const char *get_heart_rate_source_name(void *)
 {
 	return "Heart Rate Monitor";
@@ -113,12 +112,12 @@ static void create_obs_heart_display_source_if_needed()
 // Create function
 void *heart_rate_source_create(obs_data_t *settings, obs_source_t *source)
 {
-	UNUSED_PARAMETER(settings);
-
 	void *data = bmalloc(sizeof(struct heart_rate_source));
 	struct heart_rate_source *hrs = new (data) heart_rate_source();
 
 	hrs->source = source;
+	hrs->worker = std::make_unique<AnalysisWorker>();
+	heart_rate_source_update(hrs, settings);
 
 	char *effect_file;
 	obs_enter_graphics();
@@ -134,6 +133,7 @@ void *heart_rate_source_create(obs_data_t *settings, obs_source_t *source)
 	obs_leave_graphics();
 
 	hrs->texrender = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
+	hrs->patch_texrender = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
 	create_obs_heart_display_source_if_needed();
 
 	return hrs;
@@ -146,10 +146,26 @@ void heart_rate_source_destroy(void *data)
 
 	if (hrs) {
 		hrs->isDisabled = true;
+		// Stop the analysis first, it holds frames of the pool and may still be running a detection
+		hrs->worker.reset();
 		obs_enter_graphics();
 		gs_texrender_destroy(hrs->texrender);
-		if (hrs->stagesurface) {
-			gs_stagesurface_destroy(hrs->stagesurface);
+		gs_texrender_destroy(hrs->patch_texrender);
+		for (int i = 0; i < STAGE_SURFACE_COUNT; i++) {
+			if (hrs->stagesurfaces[i]) {
+				gs_stagesurface_destroy(hrs->stagesurfaces[i]);
+			}
+			if (hrs->patch_stagesurfaces[i]) {
+				gs_stagesurface_destroy(hrs->patch_stagesurfaces[i]);
+			}
+			if (hrs->means_stagesurfaces[i]) {
+				gs_stagesurface_destroy(hrs->means_stagesurfaces[i]);
+			}
+		}
+		for (int i = 0; i < REDUCE_MAX_LEVELS; i++) {
+			if (hrs->reduce_texrenders[i]) {
+				gs_texrender_destroy(hrs->reduce_texrenders[i]);
+			}
 		}
 		gs_effect_destroy(hrs->testing);
 		obs_leave_graphics();
@@ -158,11 +174,90 @@ void heart_rate_source_destroy(void *data)
 	}
 }
 
+void heart_rate_source_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_int(settings, "analysis_scale", ANALYSIS_SCALE_HALF);
+	obs_data_set_default_bool(settings, "face_roi_staging", false);
+	obs_data_set_default_bool(settings, "gpu_reduction", false);
+	obs_data_set_default_int(settings, "analysis_rate", 30);
+	obs_data_set_default_bool(settings, "integral_image", false);
+	obs_data_set_default_int(settings, "analysis_threads", static_cast<long long>(defaultAnalysisThreadCount()));
+	obs_data_set_default_int(settings, "min_skin_samples", 0);
+	obs_data_set_default_bool(settings, "face_tracking", true);
+	obs_data_set_default_int(settings, "detection_height", 360);
+	obs_data_set_default_int(settings, "face_detector", FACE_DETECTOR_HAAR);
+}
+
+void heart_rate_source_update(void *data, obs_data_t *settings)
+{
+	struct heart_rate_source *hrs = reinterpret_cast<struct heart_rate_source *>(data);
+
+	hrs->analysis_scale = static_cast<enum analysis_scale>(obs_data_get_int(settings, "analysis_scale"));
+	hrs->face_roi_staging = obs_data_get_bool(settings, "face_roi_staging");
+	hrs->gpu_reduction = obs_data_get_bool(settings, "gpu_reduction");
+	hrs->analysis_rate = static_cast<int>(obs_data_get_int(settings, "analysis_rate"));
+	hrs->integral_image = obs_data_get_bool(settings, "integral_image");
+	hrs->analysis_threads = static_cast<int>(obs_data_get_int(settings, "analysis_threads"));
+	hrs->min_skin_samples = static_cast<int>(obs_data_get_int(settings, "min_skin_samples"));
+	hrs->face_tracking = obs_data_get_bool(settings, "face_tracking");
+	hrs->detection_height = static_cast<int>(obs_data_get_int(settings, "detection_height"));
+	hrs->face_detector = static_cast<enum face_detector>(obs_data_get_int(settings, "face_detector"));
+
+	AnalysisSettings analysis_settings;
+	analysis_settings.analysisRate = hrs->analysis_rate;
+	analysis_settings.integralImage = hrs->integral_image;
+	analysis_settings.threadCount = static_cast<size_t>(std::max(hrs->analysis_threads, 1));
+	analysis_settings.minSkinSamples = static_cast<uint32_t>(std::max(hrs->min_skin_samples, 0));
+	analysis_settings.faceTracking = hrs->face_tracking;
+	analysis_settings.detectionHeight = static_cast<uint32_t>(std::max(hrs->detection_height, 1));
+	analysis_settings.faceDetector = hrs->face_detector;
+	hrs->worker->configure(analysis_settings);
+}
+
 obs_properties_t *heart_rate_source_properties(void *data)
 {
 	UNUSED_PARAMETER(data);
 	obs_properties_t *props = obs_properties_create();
 
+	// Resolution the source is downscaled to on the GPU before it is read back for analysis
+	obs_property_t *scale = obs_properties_add_list(props, "analysis_scale", obs_module_text("AnalysisScale"),
+							OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(scale, obs_module_text("AnalysisScale.Full"), ANALYSIS_SCALE_FULL);
+	obs_property_list_add_int(scale, obs_module_text("AnalysisScale.Half"), ANALYSIS_SCALE_HALF);
+	obs_property_list_add_int(scale, obs_module_text("AnalysisScale.Quarter"), ANALYSIS_SCALE_QUARTER);
+	obs_property_list_add_int(scale, obs_module_text("AnalysisScale.Fixed320p"), ANALYSIS_SCALE_FIXED_320P);
+
+	// Between full frame detections, only read back a patch around the last detected face
+	obs_properties_add_bool(props, "face_roi_staging", obs_module_text("FaceRoiStaging"));
+
+	// Between full frame detections, average the skin pixels on the GPU and only read back the mean colour
+	obs_properties_add_bool(props, "gpu_reduction", obs_module_text("GpuReduction"));
+
+	// Frames are resampled to this rate by their timestamps before the spectral analysis
+	obs_properties_add_int(props, "analysis_rate", obs_module_text("AnalysisRate"), 10, 60, 1);
+
+	// Take the skin sums of BGRA frames from a summed-area table built once per frame
+	obs_properties_add_bool(props, "integral_image", obs_module_text("IntegralImage"));
+
+	// Threads the per-frame skin statistics are split across, for large sources such as 4K
+	obs_properties_add_int(props, "analysis_threads", obs_module_text("AnalysisThreads"), 1, MAX_ANALYSIS_THREADS,
+			       1);
+
+	// Average a jittered lattice of about this many skin pixels instead of all of them, 0 to use every pixel
+	obs_properties_add_int(props, "min_skin_samples", obs_module_text("MinSkinSamples"), 0, 1000000, 1000);
+
+	// Follow the face with optical flow between detections, which then only run every few seconds
+	obs_properties_add_bool(props, "face_tracking", obs_module_text("FaceTracking"));
+
+	// Frames are downscaled by a whole factor to at least this many rows for the face cascades
+	obs_properties_add_int(props, "detection_height", obs_module_text("DetectionHeight"), 120, 1080, 10);
+
+	// Haar cascades, or the LBP face cascade for low-end machines
+	obs_property_t *detector = obs_properties_add_list(props, "face_detector", obs_module_text("FaceDetector"),
+							   OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(detector, obs_module_text("FaceDetector.Haar"), FACE_DETECTOR_HAAR);
+	obs_property_list_add_int(detector, obs_module_text("FaceDetector.LBP"), FACE_DETECTOR_LBP);
+
 	return props;
 }
 
@@ -196,10 +291,154 @@ void heart_rate_source_tick(void *data, float seconds)
 	}
 }
 
-static bool getBGRAFromStageSurface(struct heart_rate_source *hrs)
+// Size of the render target the source is drawn into before readback, according to the analysis scale setting
+static void getAnalysisSize(const struct heart_rate_source *hrs, uint32_t width, uint32_t height,
+			    uint32_t &analysis_width, uint32_t &analysis_height)
+{
+	switch (hrs->analysis_scale) {
+	case ANALYSIS_SCALE_HALF:
+		analysis_width = width / 2;
+		analysis_height = height / 2;
+		break;
+	case ANALYSIS_SCALE_QUARTER:
+		analysis_width = width / 4;
+		analysis_height = height / 4;
+		break;
+	case ANALYSIS_SCALE_FIXED_320P:
+		if (height > ANALYSIS_FIXED_HEIGHT) {
+			analysis_width =
+				static_cast<uint32_t>(static_cast<uint64_t>(width) * ANALYSIS_FIXED_HEIGHT / height);
+			analysis_height = ANALYSIS_FIXED_HEIGHT;
+		} else {
+			analysis_width = width;
+			analysis_height = height;
+		}
+		break;
+	case ANALYSIS_SCALE_FULL:
+	default:
+		analysis_width = width;
+		analysis_height = height;
+		break;
+	}
+
+	analysis_width = std::max(analysis_width, 1u);
+	analysis_height = std::max(analysis_height, 1u);
+}
+
+// Choose what to read back for this frame. A full frame is read back every FULL_FRAME_REFRESH_INTERVAL frames and
+// while no face is known, so that detection can run on it. In between, GPU reduction mode reads back the masked mean
+// colour of the last skin mask, and face ROI mode reads back the padded box around the last detected face
+static enum readback_kind getReadbackKind(struct heart_rate_source *hrs, struct vec4 &region,
+					  std::vector<struct vec4> &skin_regions)
+{
+	vec4_set(&region, 0.0f, 1.0f, 0.0f, 1.0f);
+
+	struct vec4 face;
+	if ((!hrs->face_roi_staging && !hrs->gpu_reduction) || hrs->frames_since_full >= FULL_FRAME_REFRESH_INTERVAL ||
+	    !hrs->worker->getFaceRegion(face)) {
+		hrs->frames_since_full = 0;
+		return READBACK_FULL;
+	}
+
+	if (hrs->gpu_reduction && hrs->worker->getSkinRegions(skin_regions)) {
+		hrs->frames_since_full++;
+		return READBACK_MEANS;
+	}
+
+	if (!hrs->face_roi_staging) {
+		hrs->frames_since_full = 0;
+		return READBACK_FULL;
+	}
+
+	hrs->frames_since_full++;
+
+	float pad_x = (face.y - face.x) * FACE_ROI_PADDING;
+	float pad_y = (face.w - face.z) * FACE_ROI_PADDING;
+	vec4_set(&region, std::max(face.x - pad_x, 0.0f), std::min(face.y + pad_x, 1.0f),
+		 std::max(face.z - pad_y, 0.0f), std::min(face.w + pad_y, 1.0f));
+	return READBACK_PATCH;
+}
+
+// Reduce the rendered analysis frame to a single RGBA32F texel. The first pass masks each texel with the skin
+// regions and stores the mask in alpha, and every pass averages 2x2 blocks, so the final texel holds the masked
+// colour sum and the mask count scaled by the same factor
+static gs_texture_t *reduceMaskedMeans(struct heart_rate_source *hrs, gs_texture_t *texture, uint32_t width,
+				       uint32_t height, const std::vector<struct vec4> &skin_regions)
+{
+	std::vector<std::string> params = {"mask_face", "mask_exclude_1", "mask_exclude_2", "mask_exclude_3"};
+	for (size_t i = 0; i < params.size(); i++) {
+		struct vec4 rect;
+		vec4_zero(&rect);
+		if (i < skin_regions.size()) {
+			rect = skin_regions[i];
+		}
+		gs_effect_set_vec4(gs_effect_get_param_by_name(hrs->testing, params[i].c_str()), &rect);
+	}
+
+	const char *technique = "MaskReduce";
+	for (int level = 0; level < REDUCE_MAX_LEVELS; level++) {
+		uint32_t out_width = (width + 1) / 2;
+		uint32_t out_height = (height + 1) / 2;
+
+		if (!hrs->reduce_texrenders[level]) {
+			hrs->reduce_texrenders[level] = gs_texrender_create(GS_RGBA32F, GS_ZS_NONE);
+		}
+		gs_texrender_t *texrender = hrs->reduce_texrenders[level];
+		gs_texrender_reset(texrender);
+		if (!gs_texrender_begin(texrender, out_width, out_height)) {
+			return nullptr;
+		}
+
+		struct vec2 reduce_size;
+		struct vec2 reduce_out_size;
+		vec2_set(&reduce_size, static_cast<float>(width), static_cast<float>(height));
+		vec2_set(&reduce_out_size, static_cast<float>(out_width), static_cast<float>(out_height));
+		gs_effect_set_texture(gs_effect_get_param_by_name(hrs->testing, "image"), texture);
+		gs_effect_set_vec2(gs_effect_get_param_by_name(hrs->testing, "reduce_size"), &reduce_size);
+		gs_effect_set_vec2(gs_effect_get_param_by_name(hrs->testing, "reduce_out_size"), &reduce_out_size);
+
+		gs_ortho(0.0f, static_cast<float>(out_width), 0.0f, static_cast<float>(out_height), -100.0f, 100.0f);
+		gs_blend_state_push();
+		gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+		while (gs_effect_loop(hrs->testing, technique)) {
+			gs_draw_sprite(texture, 0, out_width, out_height);
+		}
+		gs_blend_state_pop();
+		gs_texrender_end(texrender);
+
+		texture = gs_texrender_get_texture(texrender);
+		width = out_width;
+		height = out_height;
+		technique = "Reduce";
+
+		if (width == 1 && height == 1) {
+			return texture;
+		}
+	}
+
+	return nullptr;
+}
+
+static gs_stagesurf_t *&getStageSurface(struct heart_rate_source *hrs, enum readback_kind kind, uint32_t index)
+{
+	switch (kind) {
+	case READBACK_PATCH:
+		return hrs->patch_stagesurfaces[index];
+	case READBACK_MEANS:
+		return hrs->means_stagesurfaces[index];
+	case READBACK_FULL:
+	default:
+		return hrs->stagesurfaces[index];
+	}
+}
+
+// Read back the oldest staged frame of the ring into captured, returns false when there is none ready
+static bool getBGRAFromStageSurface(struct heart_rate_source *hrs, struct captured_frame &captured)
 {
 	uint32_t width;
 	uint32_t height;
+	uint32_t analysis_width;
+	uint32_t analysis_height;
 
 	// Check if the source is enabled
 	if (!obs_source_enabled(hrs->source)) {
@@ -219,12 +458,27 @@ static bool getBGRAFromStageSurface(struct heart_rate_source *hrs)
 		return false;
 	}
 
+	// The source is drawn into a smaller render target when a reduced analysis scale is selected, so only the
+	// downscaled frame is staged and copied from the GPU. A face patch is always drawn at a fixed size into its
+	// own texrender, so switching between full frames and patches does not reallocate either render target
+	struct vec4 region;
+	std::vector<struct vec4> skin_regions;
+	enum readback_kind kind = getReadbackKind(hrs, region, skin_regions);
+	bool is_patch = kind == READBACK_PATCH;
+	gs_texrender_t *texrender = is_patch ? hrs->patch_texrender : hrs->texrender;
+	if (is_patch) {
+		analysis_width = FACE_ROI_PATCH_SIZE;
+		analysis_height = FACE_ROI_PATCH_SIZE;
+	} else {
+		getAnalysisSize(hrs, width, height, analysis_width, analysis_height);
+	}
+
 	// Resets the texture renderer and begins rendering with the specified width and height
-	gs_texrender_reset(hrs->texrender);
-	if (!hrs->texrender) {
+	if (!texrender) {
 		return false;
 	}
-	if (!gs_texrender_begin(hrs->texrender, width, height)) {
+	gs_texrender_reset(texrender);
+	if (!gs_texrender_begin(texrender, analysis_width, analysis_height)) {
 		return false;
 	}
 
@@ -246,6 +500,8 @@ static bool getBGRAFromStageSurface(struct heart_rate_source *hrs)
 		 0); // Clears color/depth/stencil buffers
 
 	// Sets up an orthographic projection matrix. This matrix defines a 2D rendering space where objects are rendered without perspective distortion
+	// The projection spans the captured region of the source in base pixels, so that region is scaled to fit the
+	// analysis render target
 	// Parameters:
 	// - 0.0f: The left coordinate of the projection
 	// static_cast<float>(width): The rigCan youht coordinate of the projection, set to the width of the target source
@@ -253,7 +509,7 @@ static bool getBGRAFromStageSurface(struct heart_rate_source *hrs)
 	// static_cast<float>(height): The top coordinate of the projection, set to the height of the target source
 	// -100.0f: The near clipping plane. The near clipping plane is the closest plane to the camera. Objects closer to the camera than this plane are clipped (not rendered). It helps to avoid rendering artifacts and improves depth precision by discarding objects that are too close to the camera
 	// 100.0f: The far clipping plane. The far clipping plane is the farthest plane from the camera. Objects farther from the camera than this plane are clipped (not rendered).It helps to limit the rendering distance and manage depth buffer precision by discarding objects that are too far away
-	gs_ortho(0.0f, static_cast<float>(width), 0.0f, static_cast<float>(height), -100.0f, 100.0f);
+	gs_ortho(region.x * width, region.y * width, region.z * height, region.w * height, -100.0f, 100.0f);
 
 	// This function saves the current blend state onto a stack. The blend state includes settings that control how colors from different sources are combined during rendering. By pushing the current blend state, you can make temporary changes to the blend settings and later restore the original settings by popping the blend state from the stack
 	gs_blend_state_push();
@@ -272,83 +528,128 @@ static bool getBGRAFromStageSurface(struct heart_rate_source *hrs)
 	gs_blend_state_pop();
 
 	// This function ends the texture rendering process. It finalizes the rendering operations and makes the rendered texture available for further processing. This function completes the rendering process, ensuring that the rendered texture is properly finalised and can be used for subsequent operations, such as extracting pixel data or further processing
-	gs_texrender_end(hrs->texrender);
+	gs_texrender_end(texrender);
+
+	gs_texture_t *staged_texture = gs_texrender_get_texture(texrender);
+	enum gs_color_format staged_format = GS_BGRA;
+	if (kind == READBACK_MEANS) {
+		// Only the single texel holding the masked mean colour is staged
+		staged_texture = reduceMaskedMeans(hrs, staged_texture, analysis_width, analysis_height, skin_regions);
+		if (!staged_texture) {
+			return false;
+		}
+		analysis_width = 1;
+		analysis_height = 1;
+		staged_format = GS_RGBA32F;
+	}
+
+	// Stage into the current slot of the ring. The staging copy is queued on the GPU and does not block here
+	uint32_t stage_index = hrs->stagesurface_index;
+	gs_stagesurf_t *&stagesurface = getStageSurface(hrs, kind, stage_index);
 
 	// Retrieve the old existing stage surface
-	if (hrs->stagesurface) {
-		uint32_t stagesurf_width = gs_stagesurface_get_width(hrs->stagesurface);
-		uint32_t stagesurf_height = gs_stagesurface_get_height(hrs->stagesurface);
+	if (stagesurface) {
+		uint32_t stagesurf_width = gs_stagesurface_get_width(stagesurface);
+		uint32_t stagesurf_height = gs_stagesurface_get_height(stagesurface);
 		// If it still matches the new width and height, reuse it
-		if (stagesurf_width != width || stagesurf_height != height) {
+		if (stagesurf_width != analysis_width || stagesurf_height != analysis_height) {
 			// Destroy the old stage surface
-			gs_stagesurface_destroy(hrs->stagesurface);
-			hrs->stagesurface = nullptr;
+			gs_stagesurface_destroy(stagesurface);
+			stagesurface = nullptr;
 		}
 	}
 
 	// Create a new stage surface if necessary
-	if (!hrs->stagesurface) {
-		hrs->stagesurface = gs_stagesurface_create(width, height, GS_BGRA);
+	if (!stagesurface) {
+		stagesurface = gs_stagesurface_create(analysis_width, analysis_height, staged_format);
+		if (!stagesurface) {
+			return false;
+		}
 	}
 
-	// Use gs_stage_texture to stage the texture from the texture renderer (hrs->texrender) to the stage surface (hrs->stagesurface). This operation transfers the rendered texture to the stage surface for further processing
-	gs_stage_texture(hrs->stagesurface, gs_texrender_get_texture(hrs->texrender));
+	// Use gs_stage_texture to stage the texture from the texture renderer (hrs->texrender) to the stage surface. This operation transfers the rendered texture to the stage surface for further processing
+	gs_stage_texture(stagesurface, staged_texture);
+	hrs->stagesurface_staged[stage_index] = true;
+	hrs->stagesurface_kind[stage_index] = kind;
+	hrs->stagesurface_region[stage_index] = region;
+	hrs->stagesurface_timestamp[stage_index] = obs_get_video_frame_time();
+
+	// Advance the ring. The next slot is the oldest one, staged STAGE_SURFACE_COUNT - 1 frames ago, so its copy
+	// has already completed and mapping it does not stall the render thread waiting on the GPU
+	uint32_t read_index = (stage_index + 1) % STAGE_SURFACE_COUNT;
+	hrs->stagesurface_index = read_index;
+	enum readback_kind read_kind = hrs->stagesurface_kind[read_index];
+	gs_stagesurf_t *readsurface = getStageSurface(hrs, read_kind, read_index);
+	if (!readsurface || !hrs->stagesurface_staged[read_index]) {
+		// The ring is still filling up, no frame is ready for analysis yet
+		return false;
+	}
+	hrs->stagesurface_staged[read_index] = false;
 
 	// Use gs_stagesurface_map to map the stage surface and retrieve the video data and line size. The video_data pointer will point to the BGRA data, and linesize will indicate the number of bytes per line
 	uint8_t *video_data; // A pointer to the memory location where the BGRA data will be accessible
 	uint32_t linesize;   // The number of bytes per line (or row) of the image data
 	// The gs_stagesurface_map function creates a mapping between the GPU memory and the CPU memory. This allows the CPU to access the pixel data directly from the GPU memory
-	if (!gs_stagesurface_map(hrs->stagesurface, &video_data, &linesize)) {
+	if (!gs_stagesurface_map(readsurface, &video_data, &linesize)) {
 		return false;
 	}
 
-	{
-		std::lock_guard<std::mutex> lock(hrs->BGRA_data_mutex);
-		struct input_BGRA_data *BGRA_data = (struct input_BGRA_data *)bzalloc(sizeof(struct input_BGRA_data));
-		BGRA_data->width = width;
-		BGRA_data->height = height;
-		BGRA_data->linesize = linesize;
-		BGRA_data->data = video_data;
-		hrs->BGRA_data = BGRA_data;
-	}
+	captured.timestamp = hrs->stagesurface_timestamp[read_index];
 
-	// Use gs_stagesurface_unmap to unmap the stage surface, releasing the mapped memory.
-	gs_stagesurface_unmap(hrs->stagesurface);
-	return true;
-}
+	if (read_kind == READBACK_MEANS) {
+		// The texel holds the masked colour sum in rgb and the mask count in alpha, both averaged over the
+		// frame
+		const float *means = reinterpret_cast<const float *>(video_data);
+		bool has_skin = means[3] > 0.0f;
+		for (int i = 0; i < 3 && has_skin; i++) {
+			captured.means[i] = 255.0 * means[i] / means[3];
+		}
+		gs_stagesurface_unmap(readsurface);
 
-static gs_texture_t *draw_rectangle(struct heart_rate_source *hrs, uint32_t width, uint32_t height,
-				    std::vector<struct vec4> &face_coordinates)
-{
+		if (!has_skin) {
+			return false;
+		}
+		captured.has_means = true;
+		return true;
+	}
+
+	// Copy the frame out of the stage surface into a pooled buffer we own, since the mapped memory is only valid
+	// until the surface is unmapped. The mapped frame may predate a resolution change, so use its own surface size
+	std::shared_ptr<input_BGRA_data> BGRA_data = hrs->frame_pool.copyFrom(
+		video_data, linesize, gs_stagesurface_get_width(readsurface), gs_stagesurface_get_height(readsurface));
 
-	gs_texture_t *blurredTexture = gs_texture_create(width, height, GS_BGRA, 1, nullptr, 0);
-	gs_copy_texture(blurredTexture, gs_texrender_get_texture(hrs->texrender));
+	// Use gs_stagesurface_unmap to unmap the stage surface, releasing the mapped memory.
+	gs_stagesurface_unmap(readsurface);
 
-	gs_texrender_reset(hrs->texrender);
-	if (!gs_texrender_begin(hrs->texrender, width, height)) {
-		obs_log(LOG_INFO, "Could not open background blur texrender!");
-		return blurredTexture;
+	if (!BGRA_data) {
+		// Every pooled buffer is still referenced, drop this frame
+		return false;
 	}
+	BGRA_data->region = hrs->stagesurface_region[read_index];
+	BGRA_data->timestamp = captured.timestamp;
+
+	captured.BGRA_data = std::move(BGRA_data);
+	captured.has_means = false;
 
-	gs_effect_set_texture(gs_effect_get_param_by_name(hrs->testing, "image"), blurredTexture);
+	return true;
+}
 
+// Pass the detected rectangles to the effect so that it outlines them. The coordinates are normalised to the
+// analysis frame, which covers the whole source, so they apply unchanged to the full resolution output
+static void draw_rectangle(struct heart_rate_source *hrs, std::vector<struct vec4> &face_coordinates)
+{
 	std::vector<std::string> params = {"face", "eye_1", "eye_2", "mouth"};
 
 	for (int i = 0; i < std::min(4, static_cast<int>(face_coordinates.size())); i++) {
 		gs_effect_set_vec4(gs_effect_get_param_by_name(hrs->testing, params[i].c_str()), &face_coordinates[i]);
 	}
+}
 
-	struct vec4 background;
-	vec4_zero(&background);
-	gs_clear(GS_CLEAR_COLOR, &background, 0.0f, 0);
-	gs_ortho(0.0f, static_cast<float>(width), 0.0f, static_cast<float>(height), -100.0f, 100.0f);
-	gs_blend_state_push();
-	gs_blend_function(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA);
-
-	gs_blend_state_pop();
-	gs_texrender_end(hrs->texrender);
-	gs_copy_texture(blurredTexture, gs_texrender_get_texture(hrs->texrender));
-	return blurredTexture;
+// Whether filter_video received a frame recently, in which case the render callback does not read the source back
+static bool isAsyncAnalysisActive(struct heart_rate_source *hrs)
+{
+	uint64_t last_frame_ns = hrs->last_async_frame_ns.load();
+	return last_frame_ns != 0 && os_gettime_ns() - last_frame_ns < ASYNC_FRAME_TIMEOUT_NS;
 }
 
 // Render function
@@ -367,32 +668,37 @@ void heart_rate_source_render(void *data, gs_effect_t *effect)
 		return;
 	}
 
-	if (!getBGRAFromStageSurface(hrs)) {
-		obs_source_skip_video_filter(hrs->source);
-		return;
-	}
-
 	if (!hrs->testing) {
 		obs_log(LOG_INFO, "Effect not loaded");
 		// Effect failed to load, skip rendering
 		obs_source_skip_video_filter(hrs->source);
 		return;
 	}
+
+	// Frames of async sources are submitted by filter_video, otherwise capture the source and hand the frame over.
+	// Either way the analysis runs on the worker, the render callback only draws its latest results
+	struct captured_frame captured = {};
+	if (!isAsyncAnalysisActive(hrs) && getBGRAFromStageSurface(hrs, captured)) {
+		hrs->worker->submitRendered(std::move(captured));
+	}
+
 	std::vector<struct vec4> face_coordinates;
-	double heart_rate = avg.calculateHeartRate(hrs->BGRA_data, face_coordinates);
+	double heart_rate = 0.0;
+	hrs->worker->takeResults(heart_rate, face_coordinates);
 	std::string result = "Heart Rate: " + std::to_string((int)heart_rate);
 
-	gs_texture_t *testingTexture =
-		draw_rectangle(hrs, hrs->BGRA_data->width, hrs->BGRA_data->height, face_coordinates);
+	draw_rectangle(hrs, face_coordinates);
+
+	// The analysis frame may be downscaled, so render the output at the base size of the target
+	obs_source_t *target = obs_filter_get_target(hrs->source);
+	uint32_t width = obs_source_get_base_width(target);
+	uint32_t height = obs_source_get_base_height(target);
 
 	if (!obs_source_process_filter_begin(hrs->source, GS_BGRA, OBS_ALLOW_DIRECT_RENDERING)) {
 		obs_source_skip_video_filter(hrs->source);
-		gs_texture_destroy(testingTexture);
 		return;
 	}
 
-	gs_effect_set_texture(gs_effect_get_param_by_name(hrs->testing, "image"), testingTexture);
-
 	struct vec4 color;
 	vec4_set(&color, 1.0f, 0.0f, 0.0f, 1.0f);
 	gs_effect_set_vec4(gs_effect_get_param_by_name(hrs->testing, "color"),
@@ -401,8 +707,7 @@ void heart_rate_source_render(void *data, gs_effect_t *effect)
 	gs_blend_state_push();
 	gs_reset_blend_state();
 
-	obs_source_process_filter_tech_end(hrs->source, hrs->testing, hrs->BGRA_data->width, hrs->BGRA_data->height,
-					   "Draw");
+	obs_source_process_filter_tech_end(hrs->source, hrs->testing, width, height, "Draw");
 
 	gs_blend_state_pop();
 
@@ -414,6 +719,32 @@ void heart_rate_source_render(void *data, gs_effect_t *effect)
 		obs_data_release(source_settings);
 		obs_source_release(source);
 	}
+}
+
+// Async video filter function. Frames of async sources such as webcams are analysed straight from their CPU planes,
+// with no render, stage or map on the GPU, and are passed through untouched
+struct obs_source_frame *heart_rate_source_filter_video(void *data, struct obs_source_frame *frame)
+{
+	struct heart_rate_source *hrs = reinterpret_cast<struct heart_rate_source *>(data);
+
+	if (hrs->isDisabled || !frame || !isAsyncFormatSupported(frame->format)) {
+		return frame;
+	}
+
+	// The frame planes are only valid during this call, so copy them into a pooled buffer for the worker. Every
+	// supported format has pixel format traits, so the planes are copied as they are
+	struct captured_frame captured = {};
+	captured.BGRA_data = hrs->frame_pool.acquire(frame->width, frame->height);
+	if (!captured.BGRA_data) {
+		return frame;
+	}
+	copySourceFrame(frame, captured.BGRA_data.get());
+	vec4_set(&captured.BGRA_data->region, 0.0f, 1.0f, 0.0f, 1.0f);
+	captured.BGRA_data->timestamp = frame->timestamp;
+	captured.timestamp = frame->timestamp;
+
+	hrs->worker->submitAsync(std::move(captured));
+	hrs->last_async_frame_ns = os_gettime_ns();
 
-	gs_texture_destroy(testingTexture);
+	return frame;
 }
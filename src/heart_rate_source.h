@@ -2,9 +2,14 @@
 #define HEART_RATE_SOURCE_H
 
 #include <obs-module.h>
+#include <graphics/vec4.h>
 
 #ifdef __cplusplus
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <vector>
+#include "frame_buffer_pool.h"
 #else
 #include <stdbool.h>
 #endif
@@ -15,37 +20,131 @@ extern "C" {
 
 #define TEXT_SOURCE_NAME "Heart Rate Display"
 
+// Number of stage surfaces in the readback ring. A frame staged now is mapped
+// STAGE_SURFACE_COUNT - 1 renders later, so the GPU copy has finished by then
+#define STAGE_SURFACE_COUNT 3
+
+// Resolution of the frame that is read back for analysis, relative to the base size of the filtered source
+enum analysis_scale {
+	ANALYSIS_SCALE_FULL = 0,
+	ANALYSIS_SCALE_HALF = 1,
+	ANALYSIS_SCALE_QUARTER = 2,
+	ANALYSIS_SCALE_FIXED_320P = 3,
+};
+
+// Face detector the analysis runs: the Haar cascades, or the LBP face cascade alone, with the eye and mouth
+// exclusions placed at the usual proportions of a face, the cheaper of the two
+enum face_detector {
+	FACE_DETECTOR_HAAR = 0,
+	FACE_DETECTOR_LBP = 1,
+};
+
+#define FACE_DETECTOR_COUNT 2
+
+// Height of the analysis frame in ANALYSIS_SCALE_FIXED_320P mode
+#define ANALYSIS_FIXED_HEIGHT 320
+
+// Face ROI staging: size of the square patch the padded face box is rendered into, and the padding added on each
+// side relative to the face size
+#define FACE_ROI_PATCH_SIZE 128
+#define FACE_ROI_PADDING 0.2f
+
+// In face ROI staging and GPU reduction modes, how many frames are read back as patches or means before a full
+// frame is read back again so that detection can run on it
+#define FULL_FRAME_REFRESH_INTERVAL 10
+
+// Maximum number of halving passes of the GPU mean reduction, enough for sources up to 65536 pixels wide
+#define REDUCE_MAX_LEVELS 16
+
+// Async sources are analysed in filter_video instead of through a GPU readback while their frames keep arriving
+// within this interval
+#define ASYNC_FRAME_TIMEOUT_NS 500000000ULL
+
+// What a stage surface holds: the full analysis frame, a face ROI patch, or the GPU-reduced masked mean colour
+enum readback_kind {
+	READBACK_FULL = 0,
+	READBACK_PATCH = 1,
+	READBACK_MEANS = 2,
+};
+
 struct input_BGRA_data {
 	uint8_t *data;
 	uint32_t width;
 	uint32_t height;
 	uint32_t linesize;
+	struct vec4 region; // Normalised area of the source covered by the frame (min x, max x, min y, max y)
+	uint64_t timestamp; // Capture time of the frame in nanoseconds
+	// Pixel layout of the frame. Frames read back from the GPU are always VIDEO_FORMAT_BGRA; frames of async RGB
+	// and YUV sources are analysed as delivered, with data holding the luma or packed plane and chroma the others
+	enum video_format format;
+	uint8_t *chroma[2];
+	uint32_t chroma_linesize[2];
+	float color_matrix[16]; // YUV to RGB matrix of YUV frames, as in obs_source_frame
 };
 
+#ifdef __cplusplus
+// A frame captured on the graphics thread, either a pooled BGRA frame or the GPU-reduced masked mean colour
+struct captured_frame {
+	std::shared_ptr<input_BGRA_data> BGRA_data;
+	bool has_means;
+	double means[3];
+	uint64_t timestamp;
+};
+
+class AnalysisWorker;
+#endif
+
 struct heart_rate_source {
 	obs_source_t *source;
 	gs_texrender_t *texrender;
-	gs_stagesurf_t *stagesurface;
+	gs_texrender_t *patch_texrender;
+	gs_stagesurf_t *stagesurfaces[STAGE_SURFACE_COUNT];
+	gs_stagesurf_t *patch_stagesurfaces[STAGE_SURFACE_COUNT];
+	gs_stagesurf_t *means_stagesurfaces[STAGE_SURFACE_COUNT];
+	gs_texrender_t *reduce_texrenders[REDUCE_MAX_LEVELS];
+	bool stagesurface_staged[STAGE_SURFACE_COUNT];
+	enum readback_kind stagesurface_kind[STAGE_SURFACE_COUNT];
+	struct vec4 stagesurface_region[STAGE_SURFACE_COUNT];
+	uint64_t stagesurface_timestamp[STAGE_SURFACE_COUNT];
+	uint32_t stagesurface_index;
+	uint32_t frames_since_full;
 	gs_effect_t *testing;
 #ifdef __cplusplus
-	input_BGRA_data *BGRA_data;
-	std::mutex BGRA_data_mutex;
+	FrameBufferPool frame_pool;
+	// Time filter_video last received a frame, the render callback does not capture while async frames arrive
+	std::atomic<uint64_t> last_async_frame_ns;
+	// Runs the analysis of this filter off the graphics and video threads
+	std::unique_ptr<AnalysisWorker> worker;
 #else
-	struct input_BGRA_data *BGRA_data;
-	void *BGRA_data_mutex; // Placeholder for C compatibility
+	void *frame_pool;             // Placeholder for C compatibility
+	uint64_t last_async_frame_ns; // Placeholder for C compatibility
+	void *worker;                 // Placeholder for C compatibility
 #endif
 	bool isDisabled;
+	enum analysis_scale analysis_scale;
+	bool face_roi_staging;
+	bool gpu_reduction;
+	int analysis_rate;
+	bool integral_image;
+	int analysis_threads;
+	int min_skin_samples;
+	bool face_tracking;
+	int detection_height;
+	enum face_detector face_detector;
 };
 
 // Function declarations
 const char *get_heart_rate_source_name(void *);
 void *heart_rate_source_create(obs_data_t *settings, obs_source_t *source);
 void heart_rate_source_destroy(void *data);
+void heart_rate_source_defaults(obs_data_t *settings);
+void heart_rate_source_update(void *data, obs_data_t *settings);
 obs_properties_t *heart_rate_source_properties(void *data);
 void heart_rate_source_activate(void *data);
 void heart_rate_source_deactivate(void *data);
 void heart_rate_source_tick(void *data, float seconds);
 void heart_rate_source_render(void *data, gs_effect_t *effect);
+struct obs_source_frame *heart_rate_source_filter_video(void *data, struct obs_source_frame *frame);
 
 #ifdef __cplusplus
 }
@@ -9,7 +9,10 @@ struct obs_source_info heart_rate_source_info = {
 	.destroy = heart_rate_source_destroy,
 	.activate = heart_rate_source_activate,
 	.deactivate = heart_rate_source_deactivate,
+	.get_defaults = heart_rate_source_defaults,
 	.get_properties = heart_rate_source_properties,
+	.update = heart_rate_source_update,
 	.video_tick = heart_rate_source_tick,
 	.video_render = heart_rate_source_render,
+	.filter_video = heart_rate_source_filter_video,
 };
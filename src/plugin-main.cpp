@@ -17,6 +17,7 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 */
 
 #include "heart_rate_source_info.h"
+#include "algorithm/ChannelSums.h"
 
 #include <obs-module.h>
 #include "plugin-support.h"
@@ -28,6 +29,7 @@ extern struct obs_source_info heart_rate_source_info;
 
 bool obs_module_load(void)
 {
+	initChannelSumKernels();
 	obs_register_source(&heart_rate_source_info);
 
 	obs_log(LOG_INFO, "plugin loaded successfully (version %s)", PLUGIN_VERSION);
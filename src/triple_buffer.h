@@ -0,0 +1,64 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Wait-free single producer, single consumer triple buffer. The writer always owns a free buffer to fill and
+// publishes it without blocking; the reader always picks up the newest published buffer. Frames published while
+// the reader was busy are overwritten, and counted as such
+template<typename T> class TripleBuffer {
+private:
+	static constexpr uint8_t indexMask = 0x3;
+	// Set on the shared index when it holds a buffer published since the reader last took one
+	static constexpr uint8_t dirtyBit = 0x4;
+
+	T buffers[3];
+	uint8_t writeIndex = 0;
+	uint8_t readIndex = 1;
+	std::atomic<uint8_t> sharedIndex{2};
+
+	std::atomic<uint64_t> published{0};
+	std::atomic<uint64_t> overwritten{0};
+	std::atomic<uint64_t> consumed{0};
+
+public:
+	// Buffer owned by the writer, to be filled before calling publish()
+	T &writeBuffer() { return buffers[writeIndex]; }
+
+	// Hand the write buffer over to the reader and take back a free one
+	void publish()
+	{
+		uint8_t previous = sharedIndex.exchange(writeIndex | dirtyBit, std::memory_order_acq_rel);
+		writeIndex = previous & indexMask;
+
+		published.fetch_add(1, std::memory_order_relaxed);
+		if (previous & dirtyBit) {
+			// The reader never saw the buffer we just took back
+			overwritten.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Make the newest published buffer the read buffer, returns false if nothing was published since the last call
+	bool update()
+	{
+		if (!(sharedIndex.load(std::memory_order_relaxed) & dirtyBit)) {
+			return false;
+		}
+
+		uint8_t previous = sharedIndex.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex = previous & indexMask;
+
+		consumed.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Buffer owned by the reader, valid until the next successful update()
+	T &readBuffer() { return buffers[readIndex]; }
+
+	uint64_t framesPublished() const { return published.load(std::memory_order_relaxed); }
+	uint64_t framesOverwritten() const { return overwritten.load(std::memory_order_relaxed); }
+	uint64_t framesConsumed() const { return consumed.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "ChannelSums.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Time every kernel the CPU supports summing the pixels of a 1080p BGRA frame, row by row
+int main()
+{
+	const uint32_t width = 1920;
+	const uint32_t height = 1080;
+	const int passes = 100;
+	std::vector<uint8_t> frame(static_cast<size_t>(width) * height * 4);
+	uint32_t state = 1;
+	for (uint8_t &pixel : frame) {
+		state = state * 1103515245u + 12345u;
+		pixel = static_cast<uint8_t>(state >> 16);
+	}
+
+	BGRASpanSumKernelInfo kernels[BGRA_SPAN_SUM_KERNEL_MAX];
+	size_t kernelCount = supportedBGRASpanSumKernels(kernels);
+
+	for (size_t k = 0; k < kernelCount; k++) {
+		ChannelSums sums;
+		auto start = std::chrono::steady_clock::now();
+		for (int pass = 0; pass < passes; pass++) {
+			for (uint32_t y = 0; y < height; y++) {
+				kernels[k].kernel(frame.data() + static_cast<size_t>(y) * width * 4, width, sums);
+			}
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		// Print the sums so that the loop is not optimised away
+		printf("%-6s %.3f ms per 1080p frame (%llu)\n", kernels[k].name, elapsed.count() / passes,
+		       (unsigned long long)(sums.b + sums.g + sums.r));
+	}
+
+	return 0;
+}
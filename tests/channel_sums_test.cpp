@@ -0,0 +1,40 @@
+#include "ChannelSums.h"
+
+#include <cstdio>
+#include <vector>
+
+// Every kernel the CPU supports must give the exact sums of the scalar kernel, for every span length and
+// misalignment up to 64 pixels on a pseudo-random row of a 1080p frame
+int main()
+{
+	const uint32_t count = 1920;
+	std::vector<uint8_t> pixels(count * 4 + 64);
+	uint32_t state = 1;
+	for (uint8_t &pixel : pixels) {
+		state = state * 1103515245u + 12345u;
+		pixel = static_cast<uint8_t>(state >> 16);
+	}
+
+	BGRASpanSumKernelInfo kernels[BGRA_SPAN_SUM_KERNEL_MAX];
+	size_t kernelCount = supportedBGRASpanSumKernels(kernels);
+
+	int failures = 0;
+	for (size_t k = 0; k < kernelCount; k++) {
+		for (uint32_t offset = 0; offset < 64; offset++) {
+			uint32_t lengths[] = {offset, count - offset};
+			for (uint32_t length : lengths) {
+				ChannelSums expected, actual;
+				sumBGRASpanScalar(pixels.data() + offset, length, expected);
+				kernels[k].kernel(pixels.data() + offset, length, actual);
+				if (expected.b != actual.b || expected.g != actual.g || expected.r != actual.r) {
+					printf("%s kernel differs at offset %u, length %u\n", kernels[k].name, offset,
+					       length);
+					failures++;
+				}
+			}
+		}
+		printf("%s kernel checked\n", kernels[k].name);
+	}
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include "FaceDetection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// YuNet model, which is not shipped with the plugin, and the smallest score of the faces it reports
+#define YUNET_MODEL_FILE "face_detection_yunet_2023mar.onnx"
+#define YUNET_SCORE_THRESHOLD 0.9f
+
+// Passes over a photo, which is timed as a replay of that many identical frames
+#define PHOTO_PASSES 20
+
+// Cost and faces of one detector over the replay
+struct DetectorRun {
+	const char *name;
+	double totalMs = 0.0;
+	int framesWithFace = 0;
+	// Frames where both it and the Haar cascades found a face, and the summed overlap of their largest faces. Left
+	// at 0 for the Haar cascades themselves
+	int framesBothFound = 0;
+	double totalOverlap = 0.0;
+};
+
+static cv::Rect largestFace(const std::vector<cv::Rect> &faces)
+{
+	auto smaller = [](const cv::Rect &a, const cv::Rect &b) { return a.area() < b.area(); };
+	return faces.empty() ? cv::Rect() : *std::max_element(faces.begin(), faces.end(), smaller);
+}
+
+// Intersection over union of two rectangles
+static double overlap(const cv::Rect &a, const cv::Rect &b)
+{
+	double intersection = (a & b).area();
+	double total = a.area() + b.area() - intersection;
+	return total > 0.0 ? intersection / total : 0.0;
+}
+
+// Time a whole-image scan of the face cascade of each detector, and one inference of the YuNet model when it is
+// found, on every frame of a replay or on a photo. Frames are downscaled by a whole factor to at least the given
+// number of rows as the analysis does, and the cascades run with the settings the plugin runs them with. The Haar
+// detector also runs its eye and mouth cascades on every face found, which is not timed here. There is no ground
+// truth on a replay, so accuracy is reported as the frames each detector finds a face on, and how well its largest
+// face overlaps the one of the Haar cascades on the frames both find one
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		printf("Usage: %s <photo or video> [detection height, default 360] [YuNet model, default %s in the "
+		       "plugin data]\n",
+		       argv[0], YUNET_MODEL_FILE);
+		return 1;
+	}
+	int rows = argc > 2 ? std::max(atoi(argv[2]), 1) : 360;
+	std::string modelPath = argc > 3 ? argv[3] : std::string(PULSE_DATA_DIR "/") + YUNET_MODEL_FILE;
+
+	// A photo is read directly, anything else as a video
+	cv::Mat photo = cv::imread(argv[1], cv::IMREAD_COLOR);
+	cv::VideoCapture video;
+	if (photo.empty() && !video.open(argv[1])) {
+		printf("Cannot read %s\n", argv[1]);
+		return 1;
+	}
+
+	enum face_detector cascadeDetectors[] = {FACE_DETECTOR_HAAR, FACE_DETECTOR_LBP};
+	const size_t cascadeCount = sizeof(cascadeDetectors) / sizeof(cascadeDetectors[0]);
+	cv::CascadeClassifier cascades[FACE_DETECTOR_COUNT];
+	std::vector<DetectorRun> runs;
+	for (enum face_detector detector : cascadeDetectors) {
+		const FaceCascadeSettings &settings = faceCascadeSettings(detector);
+		if (!cascades[detector].load(std::string(PULSE_DATA_DIR "/") + settings.file)) {
+			printf("Cannot load %s\n", settings.file);
+			return 1;
+		}
+		runs.push_back({faceDetectorName(detector)});
+	}
+
+	// The model is optional, the cascades are compared alone without it
+	cv::Ptr<cv::FaceDetectorYN> yunet;
+	if (std::ifstream(modelPath).good()) {
+		yunet = cv::FaceDetectorYN::create(modelPath, "", cv::Size(320, 320), YUNET_SCORE_THRESHOLD);
+		runs.push_back({"YuNet"});
+	} else {
+		printf("No YuNet model at %s, YuNet skipped\n", modelPath.c_str());
+	}
+
+	cv::Mat frame, color, gray, detections;
+	std::vector<cv::Rect> faces;
+	int frames = 0;
+	while (photo.empty() ? video.read(frame) : frames < PHOTO_PASSES) {
+		const cv::Mat &input = photo.empty() ? frame : photo;
+		int scale = std::max(input.rows / rows, 1);
+		cv::resize(input, color, cv::Size(input.cols / scale, input.rows / scale), 0, 0, cv::INTER_AREA);
+		cv::cvtColor(color, gray, cv::COLOR_BGR2GRAY);
+		frames++;
+
+		cv::Rect haarFace;
+		for (size_t r = 0; r < runs.size(); r++) {
+			faces.clear();
+			auto start = std::chrono::steady_clock::now();
+			if (r < cascadeCount) {
+				const FaceCascadeSettings &settings = faceCascadeSettings(cascadeDetectors[r]);
+				cascades[cascadeDetectors[r]].detectMultiScale(
+					gray, faces, settings.scaleFactor, settings.minNeighbors, 0,
+					cv::Size(settings.windowSize, settings.windowSize));
+			} else {
+				// Rows of the face box, five landmarks and the score
+				yunet->setInputSize(color.size());
+				yunet->detect(color, detections);
+				for (int i = 0; i < detections.rows; i++) {
+					const float *row = detections.ptr<float>(i);
+					faces.push_back(cv::Rect(cvRound(row[0]), cvRound(row[1]), cvRound(row[2]),
+								 cvRound(row[3])));
+				}
+			}
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+			DetectorRun &run = runs[r];
+			run.totalMs += elapsed.count();
+			cv::Rect face = largestFace(faces);
+			if (r == 0) {
+				haarFace = face;
+			}
+			if (!face.empty()) {
+				run.framesWithFace++;
+				if (r > 0 && !haarFace.empty()) {
+					run.framesBothFound++;
+					run.totalOverlap += overlap(face, haarFace);
+				}
+			}
+		}
+	}
+
+	if (frames == 0) {
+		printf("No frames in %s\n", argv[1]);
+		return 1;
+	}
+	printf("%d frames, detection on %dx%d\n", frames, color.cols, color.rows);
+	for (const DetectorRun &run : runs) {
+		printf("%-5s %.3f ms per frame, face on %d frames", run.name, run.totalMs / frames, run.framesWithFace);
+		if (run.framesBothFound > 0) {
+			printf(", overlaps the Haar face by %.2f on the %d frames both found one",
+			       run.totalOverlap / run.framesBothFound, run.framesBothFound);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include "IntegralImage.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Masked sums taken from the integral image must match the sums of the mask's row spans, on random frames and
+// masks, whatever the number of threads the table is built on
+int main()
+{
+	srand(2);
+	int failures = 0;
+	for (size_t threads : {1, 4}) {
+		ThreadPool pool(threads);
+		for (int i = 0; i < 1000; i++) {
+			uint32_t width = 10 + rand() % 80;
+			uint32_t height = 10 + rand() % 80;
+			uint32_t stride = width * 4 + 8 * (rand() % 2);
+			std::vector<uint8_t> pixels(static_cast<size_t>(stride) * height);
+			for (uint8_t &pixel : pixels) {
+				pixel = static_cast<uint8_t>(rand());
+			}
+			ImageView frame;
+			frame.data = pixels.data();
+			frame.width = width;
+			frame.height = height;
+			frame.stride = stride;
+
+			SkinMask mask(width, height);
+			MaskRect face;
+			face.x = rand() % width - 5;
+			face.y = rand() % height - 5;
+			face.width = rand() % width + 5;
+			face.height = rand() % height + 5;
+			mask.setInclusion(face);
+			for (int e = rand() % 5; e > 0; e--) {
+				MaskRect exclusion;
+				exclusion.x = rand() % width - 3;
+				exclusion.y = rand() % height - 3;
+				exclusion.width = rand() % (width / 2 + 1);
+				exclusion.height = rand() % (height / 2 + 1);
+				mask.addExclusion(exclusion);
+			}
+
+			ChannelSums expected;
+			uint64_t expectedCount = 0;
+			mask.forEachSpan(width, height, [&](uint32_t y, uint32_t begin, uint32_t end) {
+				sumBGRASpanScalar(frame.row(y) + static_cast<size_t>(begin) * 4, end - begin, expected);
+				expectedCount += end - begin;
+			});
+
+			IntegralImage integral;
+			integral.build(frame, pool);
+			ChannelSums actual;
+			uint64_t count = integral.maskSum(mask, actual);
+			if (count != expectedCount || actual.b != expected.b || actual.g != expected.g ||
+			    actual.r != expected.r) {
+				printf("Mismatch on a %ux%u frame with %zu threads\n", width, height, threads);
+				failures++;
+			}
+		}
+	}
+
+	printf("%d mismatches\n", failures);
+	return failures == 0 ? 0 : 1;
+}
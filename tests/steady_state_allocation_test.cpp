@@ -0,0 +1,136 @@
+#include "AllocationCounter.h"
+#include "HeartRateAlgorithm.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define FRAME_WIDTH 640
+#define FRAME_HEIGHT 480
+#define FRAME_RATE 30
+#define FRAMES 1200
+
+// Partial range BT.709 YUV to RGB matrix, as OBS gives it with the frames
+static const float bt709Matrix[16] = {
+	1.164384f, 0.000000f, 1.792741f, -0.972945f, 1.164384f, -0.213249f, -0.532909f, 0.301483f,
+	1.164384f, 2.112402f, 0.000000f, -1.133402f, 0.000000f, 0.000000f, 0.000000f, 1.000000f,
+};
+
+// Frame of one of the paths a frame can take through MovingAvg, with its pixels redrawn before every frame
+struct TestFrame {
+	std::vector<uint8_t> pixels;
+	struct input_BGRA_data data = {};
+
+	TestFrame(enum video_format format)
+	{
+		data.width = FRAME_WIDTH;
+		data.height = FRAME_HEIGHT;
+		data.format = format;
+		data.region = {0.0f, 1.0f, 0.0f, 1.0f};
+		if (format == VIDEO_FORMAT_NV12) {
+			// Luma plane, then the interleaved U, V plane at half the resolution
+			pixels.resize(static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT * 3 / 2);
+			data.linesize = FRAME_WIDTH;
+			data.chroma[0] = pixels.data() + static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT;
+			data.chroma_linesize[0] = FRAME_WIDTH;
+			std::copy(bt709Matrix, bt709Matrix + 16, data.color_matrix);
+		} else {
+			pixels.resize(static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT * 4);
+			data.linesize = FRAME_WIDTH * 4;
+		}
+		data.data = pixels.data();
+	}
+
+	// Flat skin tone with the pulse in its green, or in its luma for NV12
+	void draw(double pulse)
+	{
+		if (data.format == VIDEO_FORMAT_NV12) {
+			size_t lumaSize = static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT;
+			uint8_t luma = static_cast<uint8_t>(std::lround(140 + pulse));
+			std::fill(pixels.begin(), pixels.begin() + lumaSize, luma);
+			for (size_t i = lumaSize; i < pixels.size(); i += 2) {
+				pixels[i] = 110;
+				pixels[i + 1] = 150;
+			}
+			return;
+		}
+		uint8_t green = static_cast<uint8_t>(std::lround(130 + pulse));
+		for (size_t i = 0; i < pixels.size(); i += 4) {
+			pixels[i] = 110;
+			pixels[i + 1] = green;
+			pixels[i + 2] = 180;
+			pixels[i + 3] = 255;
+		}
+	}
+};
+
+// Allocations of the steady-state frames of one path
+static uint64_t steadyStateAllocations(const char *name, MovingAvg &avg, TestFrame *frame)
+{
+	std::vector<struct vec4> faceCoordinates;
+	faceCoordinates.reserve(16);
+	uint64_t allocations = 0;
+	for (uint64_t i = 0; i < FRAMES; i++) {
+		// Several levels, so that the pulse survives rounding to 8 bits
+		double pulse = 3.0 * std::sin(2 * M_PI * 1.2 * i / FRAME_RATE);
+		uint64_t timestamp = i * 1000000000ULL / FRAME_RATE;
+		if (frame) {
+			frame->draw(pulse);
+			frame->data.timestamp = timestamp;
+		}
+		ColorMean mean = {180.0, 130.0 + pulse, 110.0};
+
+		uint64_t before = threadAllocationCount();
+		if (frame) {
+			faceCoordinates.clear();
+			avg.calculateHeartRate(&frame->data, faceCoordinates);
+		} else {
+			avg.calculateHeartRate(mean, timestamp);
+		}
+		if (i >= ALLOCATION_WARMUP_FRAMES) {
+			allocations += threadAllocationCount() - before;
+		}
+	}
+
+#ifdef COUNT_ALLOCATIONS
+	printf("%s: %llu allocations in %d steady-state frames\n", name, (unsigned long long)allocations,
+	       FRAMES - ALLOCATION_WARMUP_FRAMES);
+#else
+	UNUSED_PARAMETER(name);
+#endif
+	return allocations;
+}
+
+// Once warmed up, analysing a frame whose face stays put must not allocate, on every path a frame can take: skin
+// means given by the GPU reduction, BGRA frames summed span by span, on a lattice and through the integral image,
+// and NV12 frames averaged in YUV. Only COUNT_ALLOCATIONS builds count allocations, and there MovingAvg also aborts
+// on the first steady-state frame that allocates. The mask is fixed, as the cascades only load inside OBS, and the
+// tracker is off, as it allocates
+int main()
+{
+	SkinMask mask(FRAME_WIDTH, FRAME_HEIGHT);
+	mask.setInclusion({200, 100, 240, 300});
+	mask.addExclusion({240, 180, 60, 30});
+	mask.addExclusion({340, 180, 60, 30});
+	mask.addExclusion({270, 320, 100, 40});
+
+	enum path { MEANS, SPANS, LATTICE, INTEGRAL_IMAGE, NV12 };
+	const char *names[] = {"Skin means", "BGRA spans", "BGRA lattice", "BGRA integral image", "NV12"};
+	uint64_t allocations = 0;
+	for (int p = MEANS; p <= NV12; p++) {
+		MovingAvg avg;
+		avg.setFaceTracking(false);
+		avg.setSkinMask(mask);
+		avg.setIntegralImage(p == INTEGRAL_IMAGE);
+		avg.setMinSkinSamples(p == LATTICE ? 2000 : 0);
+		TestFrame bgra(VIDEO_FORMAT_BGRA);
+		TestFrame nv12(VIDEO_FORMAT_NV12);
+		TestFrame *frame = p == MEANS ? nullptr : p == NV12 ? &nv12 : &bgra;
+		allocations += steadyStateAllocations(names[p], avg, frame);
+	}
+
+#ifndef COUNT_ALLOCATIONS
+	printf("Allocations are only counted in COUNT_ALLOCATIONS builds\n");
+#endif
+	return allocations == 0 ? 0 : 1;
+}
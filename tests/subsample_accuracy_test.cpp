@@ -0,0 +1,220 @@
+#include "HeartRateAlgorithm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define FRAME_WIDTH 640
+#define FRAME_HEIGHT 480
+#define FRAME_RATE 30
+#define SECONDS 60
+#define PULSE_BPM 58.0
+// Pulse amplitude in green levels, under a level as for a still face in good light
+#define PULSE_AMPLITUDE 0.3
+// Most the heart rates estimated from the lattice means may differ on average from the ones estimated from the means
+// of every skin pixel
+#define MAX_MEAN_BPM_DIFFERENCE 1.0
+// Lattices of fewer samples are reported but not held to it. On this sequence their step is over 10, the error of
+// their moving phase has a strong component in the heart rate band, an order above the pulse, and the estimates
+// lock onto it
+#define MIN_HELD_SAMPLES 2000
+// Spacing of the spectrum MovingAvg estimates from, at its default 30 Hz analysis rate
+#define BIN_BPM (30.0 * 60.0 / 256)
+
+// Face rectangle the mask was made from. The face sways by up to FACE_SWAY pixels under it, so the mask also takes in
+// some background and the lattice meets a different part of the skin texture from frame to frame
+#define FACE_X 200
+#define FACE_Y 100
+#define FACE_WIDTH 240
+#define FACE_HEIGHT 300
+#define FACE_SWAY 8
+
+static uint32_t nextRandom(uint32_t &state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static uint8_t clampLevel(double value)
+{
+	return static_cast<uint8_t>(std::min(std::max(std::lround(value), 0L), 255L));
+}
+
+// Frames of the sequence, as BGRA and as partial range BT.709 NV12 with its colour matrix
+class Scene {
+private:
+	std::vector<int> skinTexture;
+	std::vector<int> backgroundTexture;
+	uint32_t state = 7;
+
+public:
+	std::vector<uint8_t> bgraPixels;
+	std::vector<uint8_t> nv12Pixels;
+	struct input_BGRA_data bgra = {};
+	struct input_BGRA_data nv12 = {};
+
+	Scene()
+		: skinTexture(static_cast<size_t>(FACE_WIDTH) * FACE_HEIGHT),
+		  backgroundTexture(static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT),
+		  bgraPixels(static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT * 4),
+		  nv12Pixels(static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT * 3 / 2)
+	{
+		for (int &level : skinTexture) {
+			level = static_cast<int>(nextRandom(state) % 41) - 20;
+		}
+		for (int &level : backgroundTexture) {
+			level = static_cast<int>(nextRandom(state) % 121) - 60;
+		}
+
+		static const float bt709Matrix[16] = {
+			1.164384f, 0.000000f, 1.792741f, -0.972945f, 1.164384f, -0.213249f, -0.532909f, 0.301483f,
+			1.164384f, 2.112402f, 0.000000f, -1.133402f, 0.000000f, 0.000000f, 0.000000f, 1.000000f,
+		};
+		for (struct input_BGRA_data *frame : {&bgra, &nv12}) {
+			frame->width = FRAME_WIDTH;
+			frame->height = FRAME_HEIGHT;
+			frame->region = {0.0f, 1.0f, 0.0f, 1.0f};
+		}
+		bgra.data = bgraPixels.data();
+		bgra.linesize = FRAME_WIDTH * 4;
+		bgra.format = VIDEO_FORMAT_BGRA;
+		nv12.data = nv12Pixels.data();
+		nv12.linesize = FRAME_WIDTH;
+		nv12.format = VIDEO_FORMAT_NV12;
+		nv12.chroma[0] = nv12Pixels.data() + static_cast<size_t>(FRAME_WIDTH) * FRAME_HEIGHT;
+		nv12.chroma_linesize[0] = FRAME_WIDTH;
+		std::copy(bt709Matrix, bt709Matrix + 16, nv12.color_matrix);
+	}
+
+	// Draw frame i: a textured face on a textured background, swaying sideways and nodding, under light that
+	// drifts by several levels, with the pulse in the green of the skin and per-pixel sensor noise on every pixel
+	void draw(uint64_t i)
+	{
+		double time = static_cast<double>(i) / FRAME_RATE;
+		double pulse = PULSE_AMPLITUDE * std::sin(2 * M_PI * PULSE_BPM / 60.0 * time);
+		double light = 1.0 + 0.04 * std::sin(2 * M_PI * 0.05 * time) + 0.02 * time / SECONDS;
+		double swayX = FACE_SWAY * std::sin(2 * M_PI * 0.2 * time);
+		double swayY = FACE_SWAY / 2 * std::sin(2 * M_PI * 0.13 * time);
+		int32_t left = FACE_X + static_cast<int32_t>(std::lround(swayX));
+		int32_t top = FACE_Y + static_cast<int32_t>(std::lround(swayY));
+
+		bgra.timestamp = nv12.timestamp = static_cast<uint64_t>(std::llround(time * 1e9));
+		uint8_t *chroma = nv12.chroma[0];
+		for (int32_t y = 0; y < FRAME_HEIGHT; y++) {
+			uint8_t *row = bgraPixels.data() + static_cast<size_t>(y) * bgra.linesize;
+			uint8_t *luma = nv12Pixels.data() + static_cast<size_t>(y) * nv12.linesize;
+			for (int32_t x = 0; x < FRAME_WIDTH; x++) {
+				double r, g, b;
+				if (x >= left && x < left + FACE_WIDTH && y >= top && y < top + FACE_HEIGHT) {
+					int shade = skinTexture[static_cast<size_t>(y - top) * FACE_WIDTH + (x - left)];
+					r = 180 + shade;
+					g = 130 + shade + pulse;
+					b = 110 + shade;
+				} else {
+					int shade = backgroundTexture[static_cast<size_t>(y) * FRAME_WIDTH + x];
+					r = g = b = 90 + shade;
+				}
+				// Up to 4 levels of noise before rounding, which also dithers the pulse
+				double noise = static_cast<double>(nextRandom(state) % 801) / 100.0 - 4.0;
+				r = r * light + noise;
+				g = g * light + noise;
+				b = b * light + noise;
+
+				row[x * 4] = clampLevel(b);
+				row[x * 4 + 1] = clampLevel(g);
+				row[x * 4 + 2] = clampLevel(r);
+				row[x * 4 + 3] = 255;
+				luma[x] = clampLevel(16 + 219 * (0.2126 * r + 0.7152 * g + 0.0722 * b) / 255);
+				if (x % 2 == 0 && y % 2 == 0) {
+					uint8_t *uv = chroma + static_cast<size_t>(y / 2) * nv12.chroma_linesize[0] + x;
+					uv[0] = clampLevel(128 + 224 * (-0.1146 * r - 0.3854 * g + 0.5 * b) / 255);
+					uv[1] = clampLevel(128 + 224 * (0.5 * r - 0.4542 * g - 0.0458 * b) / 255);
+				}
+			}
+		}
+	}
+};
+
+// The heart rates MovingAvg estimates from a jittered lattice of skin pixels must match the ones it estimates from
+// every skin pixel, for BGRA frames averaged by averageRGB and NV12 frames averaged by averageYUV. There is no
+// recording of a face to replay, so the sequence is synthetic but made hard for the lattice: the face sways and
+// nods under a fixed mask, the light drifts, the skin and background are textured, every pixel is noisy and the
+// pulse is under a level. The difference is the cost of subsampling in BPM, which the colour error measured online by
+// the plugin does not give
+int main()
+{
+	SkinMask mask(FRAME_WIDTH, FRAME_HEIGHT);
+	mask.setInclusion({FACE_X, FACE_Y, FACE_WIDTH, FACE_HEIGHT});
+	mask.addExclusion({240, 180, 60, 30});
+	mask.addExclusion({340, 180, 60, 30});
+	mask.addExclusion({270, 320, 100, 40});
+
+	// Every skin pixel first, then lattices of at least this many
+	const uint32_t sampleCounts[] = {0, 500, 2000, 8000};
+	const size_t samplingCount = sizeof(sampleCounts) / sizeof(sampleCounts[0]);
+	const char *formats[] = {"BGRA", "NV12"};
+	MovingAvg avgs[2][samplingCount];
+	std::vector<double> estimates[2][samplingCount];
+	for (size_t f = 0; f < 2; f++) {
+		for (size_t s = 0; s < samplingCount; s++) {
+			avgs[f][s].setFaceTracking(false);
+			avgs[f][s].setSkinMask(mask);
+			avgs[f][s].setMinSkinSamples(sampleCounts[s]);
+		}
+	}
+
+	Scene scene;
+	std::vector<struct vec4> faceCoordinates;
+	for (uint64_t i = 0; i < SECONDS * FRAME_RATE; i++) {
+		scene.draw(i);
+		for (size_t f = 0; f < 2; f++) {
+			for (size_t s = 0; s < samplingCount; s++) {
+				faceCoordinates.clear();
+				double heartRate = avgs[f][s].calculateHeartRate(f == 0 ? &scene.bgra : &scene.nv12,
+										 faceCoordinates);
+				if (heartRate > 0.0) {
+					estimates[f][s].push_back(heartRate);
+				}
+			}
+		}
+	}
+
+	int failures = 0;
+	for (size_t f = 0; f < 2; f++) {
+		// Every MovingAvg sees the same frames, so they estimate on the same ones
+		const std::vector<double> &full = estimates[f][0];
+		double finalRate = full.empty() ? 0.0 : full.back();
+		printf("%s, every skin pixel: %zu estimates, %.1f BPM at the end\n", formats[f], full.size(),
+		       finalRate);
+		if (std::fabs(finalRate - PULSE_BPM) > BIN_BPM) {
+			printf("%s, every skin pixel: more than a bin from the %.0f BPM pulse\n", formats[f],
+			       PULSE_BPM);
+			failures++;
+		}
+
+		for (size_t s = 1; s < samplingCount; s++) {
+			const std::vector<double> &sampled = estimates[f][s];
+			double meanDifference = 0.0;
+			double maxDifference = 0.0;
+			for (size_t i = 0; i < full.size() && i < sampled.size(); i++) {
+				double difference = std::fabs(sampled[i] - full[i]);
+				meanDifference += difference / full.size();
+				maxDifference = std::max(maxDifference, difference);
+			}
+			SubsampleStats stats = avgs[f][s].getSubsampleStats();
+			bool held = sampleCounts[s] >= MIN_HELD_SAMPLES;
+			printf("%s, at least %u samples, step %u: %.2f BPM from every pixel on average, up to "
+			       "%.1f, colour off by up to %.3f%s\n",
+			       formats[f], sampleCounts[s], stats.step, meanDifference, maxDifference, stats.maxError,
+			       held ? "" : ", not held to it");
+			if (held && (sampled.size() != full.size() || meanDifference > MAX_MEAN_BPM_DIFFERENCE)) {
+				failures++;
+			}
+		}
+	}
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+#include "HeartRateAlgorithm.h"
+
+#include <cmath>
+#include <cstdio>
+
+// Rate the frame means arrive at, resampled by MovingAvg to the analysis rate
+#define FRAME_RATE 60
+#define SECONDS 40
+// Length of the Welch segments of MovingAvg, whose bins are analysisRate * 60 / WELCH_SEGMENT_SIZE BPM apart
+#define WELCH_SEGMENT_SIZE 256
+
+// A pulse of known rate in the green means must come out of the estimate within half a bin of the spectrum, at
+// analysis rates other than the 30 Hz the estimate used to assume
+int main()
+{
+	int failures = 0;
+	for (double rate : {15.0, 20.0, 24.0}) {
+		for (double bpm : {60.0, 75.0, 90.0, 120.0, 150.0}) {
+			MovingAvg avg;
+			avg.setAnalysisRate(rate);
+			double estimate = 0.0;
+			for (int i = 0; i < SECONDS * FRAME_RATE; i++) {
+				double time = static_cast<double>(i) / FRAME_RATE;
+				ColorMean mean = {180.0, 130.0 + 0.5 * std::sin(2 * M_PI * bpm / 60.0 * time), 110.0};
+				uint64_t timestamp = static_cast<uint64_t>(std::llround(time * 1e9));
+				double heartRate = avg.calculateHeartRate(mean, timestamp);
+				if (heartRate > 0.0) {
+					estimate = heartRate;
+				}
+			}
+
+			double tolerance = rate * 60.0 / WELCH_SEGMENT_SIZE / 2;
+			bool passed = std::fabs(estimate - bpm) <= tolerance;
+			printf("%.0f Hz analysis, %.0f BPM pulse: %.2f BPM estimated%s\n", rate, bpm, estimate,
+			       passed ? "" : ", off by more than half a bin");
+			if (!passed) {
+				failures++;
+			}
+		}
+	}
+
+	return failures == 0 ? 0 : 1;
+}